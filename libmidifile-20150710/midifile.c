@@ -79,6 +79,9 @@ MIDIFILE_PUBLIC void (*Mf_keysig)() = NULLFUNC;
 MIDIFILE_PUBLIC void (*Mf_sqspecific)() = NULLFUNC;
 MIDIFILE_PUBLIC void (*Mf_text)() = NULLFUNC;
 
+/* If set, called to skip over a number of input bytes (e.g. with fseek) */
+MIDIFILE_PUBLIC void (*Mf_skip)() = NULLFUNC;
+
 /* Functions to implement in order to write a MIDI file */
 MIDIFILE_PUBLIC int (*Mf_putc)() = NULLFUNC;
 MIDIFILE_PUBLIC void (*Mf_wtrack)() = NULLFUNC;
@@ -91,6 +94,7 @@ MIDIFILE_PUBLIC long Mf_currtime = 0L;
 
 /* private stuff */
 static long Mf_toberead = 0L;
+static int Mf_skiptrk = 0;    /* 1 => rest of the track is to be skipped */
 static long Mf_numbyteswritten = 0L;
 
 static void mferror(char *s)
@@ -266,6 +270,157 @@ static void msgadd(int c)
     Msgbuff[Msgindex++] = c;
 }
 
+/*
+ * Arenas – memory for what a program keeps of the decode of one file
+ * (copies of messages, event arrays, track tables).  It is carved from
+ * blocks of ARENABLOCK bytes and released all at once with
+ * mf_arena_reset() or mf_arena_free(); a reset arena keeps its blocks,
+ * so that decoding the next file in it needs no malloc at all.
+ */
+
+#define ARENABLOCK 65536
+
+union mf_align {      /* the alignment of what is handed out */
+    long l;
+    double d;
+    void *p;
+};
+
+/* what an allocation of n bytes takes, at least one union mf_align */
+#define ALIGNED(n) ((n) ? ((n) + sizeof(union mf_align) - 1) & \
+        ~(unsigned long)(sizeof(union mf_align) - 1) : sizeof(union mf_align))
+
+struct mf_block {
+    struct mf_block *next;
+    unsigned long size;
+    union mf_align data[1];
+};
+
+struct mf_arena {
+    struct mf_block *used;    /* the current block first */
+    struct mf_block *spare;   /* blocks of ARENABLOCK bytes kept by a reset */
+    char *p, *end;            /* what is left of the current block */
+};
+
+static struct mf_block *newblock(unsigned long size)
+{
+    struct mf_block *b;
+
+    b = (struct mf_block *)malloc(sizeof(struct mf_block) -
+            sizeof(union mf_align) + size);
+    if (b == NULL)
+        mferror("malloc error!");
+    b->size = size;
+    return b;
+}
+
+MIDIFILE_PUBLIC struct mf_arena *mf_arena_new(void)
+{
+    struct mf_arena *a;
+
+    a = (struct mf_arena *)malloc(sizeof(struct mf_arena));
+    if (a == NULL)
+        mferror("malloc error!");
+    a->used = a->spare = NULL;
+    a->p = a->end = NULL;
+    return a;
+}
+
+/* size bytes, aligned for any type */
+MIDIFILE_PUBLIC void *mf_arena_alloc(struct mf_arena *a, unsigned long size)
+{
+    struct mf_block *b;
+    char *p;
+
+    size = ALIGNED(size);
+    if (size <= (unsigned long)(a->end - a->p)) {
+        p = a->p;
+        a->p += size;
+        return p;
+    }
+    if (size > ARENABLOCK / 4) {
+        /* a block of its own, behind the current one */
+        b = newblock(size);
+        if (a->used) {
+            b->next = a->used->next;
+            a->used->next = b;
+        } else {
+            b->next = NULL;
+            a->used = b;
+            a->p = a->end = (char *)b->data + size;
+        }
+        return b->data;
+    }
+    if ((b = a->spare) != NULL)
+        a->spare = b->next;
+    else
+        b = newblock(ARENABLOCK);
+    b->next = a->used;
+    a->used = b;
+    a->p = (char *)b->data + size;
+    a->end = (char *)b->data + ARENABLOCK;
+    return b->data;
+}
+
+/*
+ * Resize p, of oldsize bytes, to size bytes.  The last allocation
+ * shrinks or grows in place when there is room; otherwise it is copied.
+ */
+MIDIFILE_PUBLIC void *mf_arena_realloc(struct mf_arena *a, void *p,
+        unsigned long oldsize, unsigned long size)
+{
+    char *q = (char *)p;
+
+    if (q != NULL && q + ALIGNED(oldsize) == a->p && (size <= oldsize ||
+            ALIGNED(size) - ALIGNED(oldsize) <=
+            (unsigned long)(a->end - a->p))) {
+        a->p = q + ALIGNED(size);
+        return p;
+    }
+    q = (char *)mf_arena_alloc(a, size);
+    if (p != NULL)
+        memcpy(q, p, oldsize < size ? oldsize : size);
+    return q;
+}
+
+/* a copy of the size bytes at data, e.g. a message passed to a callback */
+MIDIFILE_PUBLIC char *mf_arena_copy(struct mf_arena *a, char *data,
+        unsigned long size)
+{
+    return (char *)memcpy(mf_arena_alloc(a, size), data, size);
+}
+
+/* release everything allocated from a, keeping its blocks for reuse */
+MIDIFILE_PUBLIC void mf_arena_reset(struct mf_arena *a)
+{
+    struct mf_block *b, *next;
+
+    for (b = a->used; b != NULL; b = next) {
+        next = b->next;
+        if (b->size == ARENABLOCK) {
+            b->next = a->spare;
+            a->spare = b;
+        } else
+            free(b);
+    }
+    a->used = NULL;
+    a->p = a->end = NULL;
+}
+
+MIDIFILE_PUBLIC void mf_arena_free(struct mf_arena *a)
+{
+    struct mf_block *b, *next;
+
+    if (a == NULL)
+        return;
+    mf_arena_reset(a);
+    for (b = a->spare; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    free(a);
+}
+
 static void metaevent(int type)
 {
     int leng = msgleng();
@@ -404,6 +559,26 @@ static void readheader(void) /* read a header chunk */
         (void) egetc();
 }
 
+static void skipbytes(long n)
+{
+    if (Mf_skip) {
+        (*Mf_skip)(n);
+        Mf_toberead -= n;
+    } else
+        while (n-- > 0)
+            (void) egetc();
+}
+
+/*
+ * mf_skiptrack() – may be called from any of the callbacks to stop
+ *                  decoding the current track.  The rest of the track
+ *                  is skipped and Mf_endtrack is called as usual.
+ */
+MIDIFILE_PUBLIC void mf_skiptrack(void)
+{
+    Mf_skiptrk = 1;
+}
+
 static int readtrack(void) /* read a track chunk */
 {
     /* This array is indexed by the high half of a status byte.  It’s */
@@ -425,11 +600,17 @@ static int readtrack(void) /* read a track chunk */
 
     Mf_toberead = read32bit();
     Mf_currtime = 0;
+    Mf_skiptrk = 0;
 
     if (Mf_starttrack)
         (*Mf_starttrack)();
 
     while (Mf_toberead > 0) {
+        if (Mf_skiptrk) {
+            skipbytes(Mf_toberead);
+            break;
+        }
+
         Mf_currtime += readvarinum();    /* delta time */
 
         c = egetc();
@@ -765,6 +946,24 @@ MIDIFILE_PUBLIC void mf_w_tempo(unsigned long delta_time,
     eputc((unsigned)(0xff & tempo));
 }
 
+/*
+ * data – track data that was encoded before, e.g. by the mf_w_ functions
+ *        in an earlier run; it must not end with an End of Track event.
+ * size – its length in bytes.
+ * Running status starts again after it.
+ */
+MIDIFILE_PUBLIC int mf_w_bytes(unsigned char *data, unsigned long size)
+{
+    unsigned long i;
+
+    for (i = 0; i < size; i++) {
+        if (eputc(data[i]) != data[i])
+            return(-1);
+    }
+    laststat = 0;
+    return(size);
+} /* end mf_w_bytes */
+
 static void mf_w_track_chunk(int which_track, FILE *fp, void (*wtrack)())
 {
     unsigned long trkhdr,trklength;
@@ -40,10 +40,23 @@ MIDIFILE_PUBLIC extern void (*Mf_tempo)();
 MIDIFILE_PUBLIC extern void (*Mf_keysig)();
 MIDIFILE_PUBLIC extern void (*Mf_arbitrary)();
 MIDIFILE_PUBLIC extern void (*Mf_error)();
+MIDIFILE_PUBLIC extern void (*Mf_skip)();
 MIDIFILE_PUBLIC extern long Mf_currtime;
 MIDIFILE_PUBLIC extern int Mf_nomerge;
 MIDIFILE_PUBLIC void mfread(void);
 MIDIFILE_PUBLIC void midifile(void);
+MIDIFILE_PUBLIC void mf_skiptrack(void);
+
+/* arenas for what is kept of the decode of a file */
+struct mf_arena;
+MIDIFILE_PUBLIC struct mf_arena *mf_arena_new(void);
+MIDIFILE_PUBLIC void *mf_arena_alloc(struct mf_arena *a, unsigned long size);
+MIDIFILE_PUBLIC void *mf_arena_realloc(struct mf_arena *a, void *p,
+        unsigned long oldsize, unsigned long size);
+MIDIFILE_PUBLIC char *mf_arena_copy(struct mf_arena *a, char *data,
+        unsigned long size);
+MIDIFILE_PUBLIC void mf_arena_reset(struct mf_arena *a);
+MIDIFILE_PUBLIC void mf_arena_free(struct mf_arena *a);
 
 /* definitions for MIDI file writing code */
 MIDIFILE_PUBLIC extern int Mf_RunStat;
@@ -64,6 +77,7 @@ MIDIFILE_PUBLIC int mf_w_sysex_event(unsigned long delta_time,
         unsigned char *data, unsigned long size);
 MIDIFILE_PUBLIC void mf_w_tempo(unsigned long delta_time,
         unsigned long tempo);
+MIDIFILE_PUBLIC int mf_w_bytes(unsigned char *data, unsigned long size);
 
 /* MIDI status commands most significant bit is 1 */
 #define note_off                0x80
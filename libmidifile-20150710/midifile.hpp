@@ -0,0 +1,534 @@
+/*
+ * midifile.hpp
+ *
+ * A header-only C++ interface to the reading side of the library.
+ * Instead of assigning the Mf_* function pointers, derive a handler from
+ * mf::reader<> and give it member functions with the names of the
+ * callbacks:
+ *
+ *      struct notes : mf::reader<notes> {
+ *          long n;
+ *          notes() : n(0) {}
+ *          void on(int chan, int pitch, int vol) { if (vol) n++; }
+ *      };
+ *
+ *      notes h;
+ *      mf::input in("song.mid");
+ *      if (in.ok() && h.read(in))
+ *          printf("%ld notes\n", h.n);
+ *
+ * read() calls the members of the handler directly rather than through
+ * pointers, so the compiler can inline them into the decode loop; the
+ * ones the handler does not define are the empty ones of mf::reader and
+ * disappear.  The file is read into memory by mf::input, and the text,
+ * meta, sysex and arbitrary events are passed as pointers into it, so
+ * nothing is copied except a sysex that is merged from several parts.
+ *
+ * The events and their arguments are those of mfread(), with the same
+ * handling of running status and of continued sysex messages (see
+ * set_nomerge()).  An error calls the error() member with the message
+ * mfread() would give, and read() then returns false instead of exiting.
+ * There is no global state, so several files can be read at once.
+ */
+
+#ifndef MIDIFILE_HPP
+#define MIDIFILE_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "midifile.h"
+
+namespace mf {
+
+/* An open stdio file that is closed when it goes out of scope */
+class file {
+public:
+    file(const char *name, const char *mode) : fp(std::fopen(name, mode)) {}
+    ~file() { if (fp) std::fclose(fp); }
+    std::FILE *get() const { return fp; }
+
+private:
+    std::FILE *fp;
+    file(const file &);
+    file &operator=(const file &);
+};
+
+/* The bytes of a MIDI file, read into memory at once */
+class input {
+public:
+    input() : good(false) {}
+    explicit input(const char *name) : good(false) { load(name); }
+    explicit input(std::FILE *fp) : good(false) { load(fp); }
+
+    bool load(const char *name)
+    {
+        file f(name, "rb");
+
+        if (f.get() == NULL)
+            return good = false;
+        return load(f.get());
+    }
+
+    /* Read fp up to its end; fp is left open */
+    bool load(std::FILE *fp)
+    {
+        char buf[65536];
+        std::size_t n;
+
+        bytes.clear();
+        while ((n = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+            bytes.insert(bytes.end(), buf, buf + n);
+        return good = !std::ferror(fp);
+    }
+
+    bool ok() const { return good; }
+    const char *data() const { return bytes.empty() ? NULL : &bytes[0]; }
+    std::size_t size() const { return bytes.size(); }
+
+private:
+    std::vector<char> bytes;
+    bool good;
+};
+
+/*
+ * The base of a handler.  Handler is the class derived from it; its
+ * members hide the empty ones below.
+ */
+template <class Handler>
+class reader {
+public:
+    reader() : P(NULL), Pos(0), Size(0), Failed(false), State(S_DONE),
+            Currtime(0), Nomerge(0), Skiptrk(0) {}
+
+    /* The callbacks, with the arguments of the Mf_* ones */
+    void error(const char * /*msg*/) {}
+    void header(int /*format*/, int /*ntrks*/, int /*division*/) {}
+    void starttrack() {}
+    void endtrack() {}
+    void on(int /*chan*/, int /*pitch*/, int /*vol*/) {}
+    void off(int /*chan*/, int /*pitch*/, int /*vol*/) {}
+    void pressure(int /*chan*/, int /*pitch*/, int /*press*/) {}
+    void parameter(int /*chan*/, int /*control*/, int /*value*/) {}
+    void pitchbend(int /*chan*/, int /*lsb*/, int /*msb*/) {}
+    void program(int /*chan*/, int /*program*/) {}
+    void chanpressure(int /*chan*/, int /*press*/) {}
+    void sysex(int /*leng*/, const char * /*msg*/) {}
+    void arbitrary(int /*leng*/, const char * /*msg*/) {}
+    void metamisc(int /*type*/, int /*leng*/, const char * /*msg*/) {}
+    void seqnum(int /*num*/) {}
+    void eot() {}
+    void smpte(int /*hr*/, int /*mn*/, int /*se*/, int /*fr*/, int /*ff*/) {}
+    void tempo(long /*tempo*/) {}
+    void timesig(int /*nn*/, int /*dd*/, int /*cc*/, int /*bb*/) {}
+    void keysig(int /*sf*/, int /*mi*/) {}
+    void sqspecific(int /*leng*/, const char * /*msg*/) {}
+    void text(int /*type*/, int /*leng*/, const char * /*msg*/) {}
+
+    /*
+     * Every meta event comes here first; this one calls the callbacks
+     * above.  A handler that wants the meta events undecoded can define
+     * its own.
+     */
+    void meta(int type, int leng, const char *m)
+    {
+        char b[5] = { 0, 0, 0, 0, 0 };  /* the decoded ones, 0 if short */
+
+        std::memcpy(b, m, leng < 5 ? leng : 5);
+        switch (type) {
+        case 0x00:
+            self().seqnum((b[0] & 0xff) << 8 | (b[1] & 0xff));
+            break;
+        case 0x01: case 0x02: case 0x03: case 0x04:
+        case 0x05: case 0x06: case 0x07: case 0x08:
+        case 0x09: case 0x0a: case 0x0b: case 0x0c:
+        case 0x0d: case 0x0e: case 0x0f:
+            self().text(type, leng, m);
+            break;
+        case 0x2f:
+            self().eot();
+            break;
+        case 0x51:
+            self().tempo((long)(b[0] & 0xff) << 16 | (b[1] & 0xff) << 8 |
+                    (b[2] & 0xff));
+            break;
+        case 0x54:
+            self().smpte(b[0], b[1], b[2], b[3], b[4]);
+            break;
+        case 0x58:
+            self().timesig(b[0], b[1], b[2], b[3]);
+            break;
+        case 0x59:
+            self().keysig(b[0], b[1]);
+            break;
+        case 0x7f:
+            self().sqspecific(leng, m);
+            break;
+        default:
+            self().metamisc(type, leng, m);
+        }
+    }
+
+    /* The time of the current event, in ticks from the start of the track */
+    long currtime() const { return Currtime; }
+
+    /* As Mf_nomerge: 1 => continued system exclusives are not collapsed */
+    void set_nomerge(int nomerge) { Nomerge = nomerge; }
+
+    /* As mf_skiptrack(): skip the rest of the current track */
+    void skiptrack() { Skiptrk = 1; }
+
+    bool read(const input &in) { return read(in.data(), in.size()); }
+
+    /* Decode the size bytes at data; false after an error */
+    bool read(const char *data, std::size_t size)
+    {
+        start(data, size);
+        while (decode((unsigned long)-1))
+            ;
+        return !Failed;
+    }
+
+    /*
+     * Decoding in steps: start() and then decode() until it returns
+     * false.  The bytes must stay there until then.
+     */
+    void start(const input &in) { start(in.data(), in.size()); }
+
+    void start(const char *data, std::size_t size)
+    {
+        P = reinterpret_cast<const unsigned char *>(data);
+        Pos = 0;
+        Size = size;
+        Failed = false;
+        State = S_HEADER;
+    }
+
+    /*
+     * Decode up to n events of the tracks; false when the file is done
+     * or after an error.
+     */
+    bool decode(unsigned long n)
+    {
+        if (State == S_HEADER)
+            State = readheader() ? S_TRACKS : S_DONE;
+        while (State != S_DONE && n > 0) {
+            if (State == S_TRACKS)
+                State = readmtrk() ? S_TRACK : S_DONE;
+            if (State == S_TRACK)
+                n = readevents(n);
+        }
+        return State != S_DONE;
+    }
+
+    bool failed() const { return Failed; }
+
+private:
+    enum { S_HEADER, S_TRACKS, S_TRACK, S_DONE };
+
+    const unsigned char *P;
+    std::size_t Pos, Size;
+    bool Failed;
+    int State;
+    unsigned long Currtime;
+    int Nomerge;
+    int Skiptrk;
+    std::vector<char> Msg;      /* a sysex being merged */
+
+    /* the track being decoded */
+    unsigned long long End;
+    int Status;                 /* status value (e.g. 0x90==note-on) */
+    int Sysexcontinue;          /* 1 if last message was an unfinished sysex */
+
+    Handler &self() { return static_cast<Handler &>(*this); }
+
+    /*
+     * Does the handler have its own sysex()?  If not, merged sysex
+     * messages are not collected.  The deduced T is the class that
+     * declares the member, so this is a constant.
+     */
+    template <class T>
+    static bool own(void (T::*)(int, const char *))
+    {
+        return !same<T, reader>::value;
+    }
+    template <class A, class B> struct same { enum { value = 0 }; };
+    template <class A> struct same<A, A> { enum { value = 1 }; };
+
+    void msgadd(const char *m, unsigned long n)
+    {
+        if (own(&Handler::sysex))
+            Msg.insert(Msg.end(), m, m + n);
+    }
+
+    void sysexout()
+    {
+        if (own(&Handler::sysex))
+            self().sysex((int)Msg.size(), &Msg[0]);
+    }
+
+    void fail(const char *s)
+    {
+        if (!Failed)
+            self().error(s);
+        Failed = true;
+        Pos = Size;
+        State = S_DONE;
+    }
+
+    int egetc()
+    {
+        if (Pos >= Size) {
+            fail("premature EOF");
+            return 0;
+        }
+        return P[Pos++];
+    }
+
+    unsigned long readvarinum()
+    {
+        unsigned long value;
+        int c;
+
+        c = egetc();
+        value = c;
+        if (c & 0x80) {
+            value &= 0x7f;
+            do {
+                c = egetc();
+                value = (value << 7) + (c & 0x7f);
+            } while (c & 0x80);
+        }
+        return value;
+    }
+
+    unsigned long read32bit()
+    {
+        unsigned long value = 0;
+
+        for (int i = 0; i < 4; i++)
+            value = value << 8 | egetc();
+        return value;
+    }
+
+    int read16bit()
+    {
+        int c1 = egetc();
+
+        return c1 << 8 | egetc();
+    }
+
+    /* Take n bytes; NULL, after the error, when they are not all there */
+    const char *take(unsigned long n)
+    {
+        const char *m = reinterpret_cast<const char *>(P + Pos);
+
+        if (n > Size - Pos) {
+            fail("premature EOF");
+            return NULL;
+        }
+        Pos += n;
+        return m;
+    }
+
+    /* Read through "MThd" or "MTrk"; false at the end of the file */
+    bool readmt(const char *s)
+    {
+        for (int n = 0; n < 4; n++) {
+            if (Pos >= Size)
+                return false;
+            if (P[Pos++] != (unsigned char)s[n]) {
+                char buff[32];
+
+                std::strcpy(buff, "expecting ");
+                std::strcat(buff, s);
+                fail(buff);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool readheader()
+    {
+        int format, ntrks, division;
+        unsigned long toberead;
+        std::size_t start;
+
+        if (!readmt("MThd"))
+            return !Failed;
+        toberead = read32bit();
+        start = Pos;
+        format = read16bit();
+        ntrks = read16bit();
+        division = read16bit();
+        if (Failed)
+            return false;
+        self().header(format, ntrks, division);
+        /* flush any extra stuff, in case the length of header is not 6 */
+        if (toberead > 6)
+            take(toberead - (Pos - start));
+        return !Failed;
+    }
+
+    void chanmessage(int status, int c1, int c2)
+    {
+        int chan = status & 0xf;
+
+        switch (status & 0xf0) {
+        case 0x80:
+            self().off(chan, c1, c2);
+            break;
+        case 0x90:
+            self().on(chan, c1, c2);
+            break;
+        case 0xa0:
+            self().pressure(chan, c1, c2);
+            break;
+        case 0xb0:
+            self().parameter(chan, c1, c2);
+            break;
+        case 0xe0:
+            self().pitchbend(chan, c1, c2);
+            break;
+        case 0xc0:
+            self().program(chan, c1);
+            break;
+        case 0xd0:
+            self().chanpressure(chan, c1);
+            break;
+        }
+    }
+
+    /* Start a track; false at the end of the file or after an error */
+    bool readmtrk()
+    {
+        if (!readmt("MTrk"))
+            return false;
+        End = read32bit();
+        End += Pos;
+        if (Failed)
+            return false;
+        Currtime = 0;
+        Skiptrk = 0;
+        Status = 0;
+        Sysexcontinue = 0;
+        self().starttrack();
+        return true;
+    }
+
+    /*
+     * Decode up to n events of the current track and return how many
+     * more may be decoded.  At the end of the track State becomes
+     * S_TRACKS.
+     */
+    unsigned long readevents(unsigned long n)
+    {
+        /* the number of data bytes of a channel message, by high nibble */
+        static const int chantype[] = {
+            0, 0, 0, 0, 0, 0, 0, 0,
+            2, 2, 2, 2, 1, 1, 2, 0
+        };
+        unsigned long len;
+        const char *m;
+        int c, c1 = 0, c2, type, needed, last;
+        int running = 0;
+
+        for (; Pos < End; n--) {
+            if (n == 0)
+                return 0;
+            if (Skiptrk) {
+                take((unsigned long)(End - Pos));
+                break;
+            }
+
+            Currtime += readvarinum();
+            c = egetc();
+            if (Failed)
+                return 0;
+
+            if (Sysexcontinue && c != 0xf7) {
+                fail("didn’t find expected continuation of a sysex");
+                return 0;
+            }
+            if ((c & 0x80) == 0) {      /* running status? */
+                if (Status == 0) {
+                    fail("unexpected running status");
+                    return 0;
+                }
+                running = 1;
+                c1 = c;
+                c = Status;
+            } else if (c < 0xf0) {
+                Status = c;
+                running = 0;
+            }
+
+            needed = chantype[c >> 4];
+            if (needed) {
+                if (!running)
+                    c1 = egetc();
+                c2 = needed > 1 ? egetc() : 0;
+                if (Failed)
+                    return 0;
+                chanmessage(Status, c1, c2);
+                continue;
+            }
+
+            switch (c) {
+            case 0xff:          /* meta event */
+                type = egetc();
+                len = readvarinum();
+                if (Failed || (m = take(len)) == NULL)
+                    return 0;
+                self().meta(type, (int)len, m);
+                break;
+
+            case 0xf0:          /* start of system exclusive */
+                len = readvarinum();
+                if (Failed || (m = take(len)) == NULL)
+                    return 0;
+                last = len > 0 ? m[len - 1] & 0xff : 0xf0;
+                Msg.assign(1, (char)0xf0);
+                msgadd(m, len);
+                if (last == 0xf7 || Nomerge == 0)
+                    sysexout();
+                else
+                    Sysexcontinue = 1;  /* merge into next msg */
+                break;
+
+            case 0xf7:          /* sysex continuation or arbitrary stuff */
+                len = readvarinum();
+                if (Failed || (m = take(len)) == NULL)
+                    return 0;
+                if (!Sysexcontinue) {
+                    self().arbitrary((int)len, m);
+                    break;
+                }
+                msgadd(m, len);
+                if (len == 0 || (m[len - 1] & 0xff) == 0xf7) {
+                    sysexout();
+                    Sysexcontinue = 0;
+                }
+                break;
+
+            default: {
+                char buff[32];
+
+                std::sprintf(buff, "unexpected byte: 0x%02x", c);
+                fail(buff);
+                return 0;
+            }
+            }
+        }
+        if (Failed)
+            return 0;
+        self().endtrack();
+        State = S_TRACKS;
+        return n;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * midifile_events.hpp
+ *
+ * The events of a MIDI file as a C++20 generator, for code that is
+ * easier to write as a loop than as callbacks:
+ *
+ *      mf::input in("song.mid");
+ *      auto evs = mf::read_events(in);
+ *
+ *      for (const mf::event &e : evs)
+ *          if (e.type() == note_on && e.data2 > 0) {
+ *              printf("first note at %ld in track %d\n", e.time, e.track);
+ *              break;
+ *          }
+ *
+ * The decoder is the one of midifile.hpp.  It runs in a coroutine that
+ * decodes a batch of events (1024 unless given) at a time into a vector,
+ * so the coroutine is suspended and resumed once per batch and not once
+ * per event; going from one event to the next is an increment.
+ *
+ * An event is described as in the token format of mf2t -T: status is 01
+ * at the start of a track and 02 at its end, 80–EF for a channel message
+ * (with data1 and data2 as in the file, 0 when there is no second byte),
+ * F0 for a sysex, F7 for arbitrary data and FF for a meta event, which
+ * has its type in data1.  The last three have their bytes in msg and
+ * leng, undecoded; the sysex starts with the F0 as in Mf_sysex.  The
+ * bytes of meta events and arbitrary data are in the input and valid as
+ * long as it is, those of a sysex only until the iterator moves on.
+ *
+ * The header is available from format(), ntrks() and division() once
+ * begin() has been called.  After an error the events stop and error()
+ * returns the message; it is NULL otherwise.
+ */
+
+#ifndef MIDIFILE_EVENTS_HPP
+#define MIDIFILE_EVENTS_HPP
+
+#if !defined(__cpp_impl_coroutine)
+#error "midifile_events.hpp needs a compiler with C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include "midifile.hpp"
+
+namespace mf {
+
+struct event {
+    long time;          /* ticks from the start of the track */
+    int track;          /* counting from 0 */
+    int status;
+    int data1, data2;
+    int leng;
+    const char *msg;
+
+    int chan() const { return status & 0x0f; }
+    /* the status without the channel, e.g. note_on */
+    int type() const { return status >= 0x80 && status < 0xf0 ?
+            status & 0xf0 : status; }
+};
+
+namespace detail {
+
+/* The handler that puts the events in a batch */
+struct collector : reader<collector> {
+    std::vector<event> batch;
+    std::vector<char> store;    /* the sysex messages of the batch */
+    int track = -1;
+    int format = 0, ntrks = 0, division = 0;
+    std::string err;
+    bool failed = false;
+
+    void add(int status, int data1, int data2, int leng = 0,
+            const char *msg = nullptr)
+    {
+        batch.push_back(event{currtime(), track, status, data1, data2,
+                leng, msg});
+    }
+
+    void error(const char *msg) { err = msg; failed = true; }
+    void header(int f, int n, int d) { format = f; ntrks = n; division = d; }
+    void starttrack() { track++; add(0x01, 0, 0); }
+    void endtrack() { add(0x02, 0, 0); }
+    void on(int chan, int pitch, int vol) { add(note_on | chan, pitch, vol); }
+    void off(int chan, int pitch, int vol) { add(note_off | chan, pitch, vol); }
+    void pressure(int chan, int pitch, int press)
+        { add(poly_aftertouch | chan, pitch, press); }
+    void parameter(int chan, int control, int value)
+        { add(control_change | chan, control, value); }
+    void pitchbend(int chan, int lsb, int msb)
+        { add(pitch_wheel | chan, lsb, msb); }
+    void program(int chan, int prog) { add(program_chng | chan, prog, 0); }
+    void chanpressure(int chan, int press)
+        { add(channel_aftertouch | chan, press, 0); }
+    void arbitrary(int leng, const char *msg) { add(0xf7, 0, 0, leng, msg); }
+    void meta(int type, int leng, const char *msg)
+        { add(meta_event, type, 0, leng, msg); }
+
+    /* the message is copied, as the reader reuses its buffer */
+    void sysex(int leng, const char *msg)
+    {
+        add(system_exclusive, (int)store.size(), 0, leng);
+        store.insert(store.end(), msg, msg + leng);
+    }
+
+    /* point the sysex events at their copies, once store has stopped growing */
+    void resolve()
+    {
+        for (event &e : batch)
+            if (e.status == system_exclusive) {
+                e.msg = store.data() + e.data1;
+                e.data1 = 0;
+            }
+    }
+
+    void clear()
+    {
+        batch.clear();
+        store.clear();
+    }
+};
+
+}
+
+class events {
+public:
+    struct promise_type {
+        const std::vector<event> *batch = nullptr;
+        int format = 0, ntrks = 0, division = 0;
+        std::string err;
+        bool failed = false;
+
+        events get_return_object()
+        {
+            return events(std::coroutine_handle<promise_type>::from_promise(
+                    *this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept { batch = nullptr; }
+        void unhandled_exception() { throw; }
+
+        std::suspend_always yield_value(detail::collector &c)
+        {
+            batch = &c.batch;
+            format = c.format;
+            ntrks = c.ntrks;
+            division = c.division;
+            if (c.failed && !failed) {
+                err = c.err;
+                failed = true;
+            }
+            return {};
+        }
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = event;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const event *;
+        using reference = const event &;
+
+        iterator() = default;
+        explicit iterator(handle h) : h(h) {}
+
+        const event &operator*() const { return (*h.promise().batch)[i]; }
+        const event *operator->() const { return &**this; }
+
+        iterator &operator++()
+        {
+            if (++i == h.promise().batch->size()) {
+                i = 0;
+                next(h);
+            }
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return h.done(); }
+
+    private:
+        handle h;
+        std::size_t i = 0;
+    };
+
+    events(events &&o) noexcept :
+            h(std::exchange(o.h, {})), started(o.started) {}
+    events &operator=(events &&o) noexcept
+    {
+        if (this != &o) {
+            if (h)
+                h.destroy();
+            h = std::exchange(o.h, {});
+            started = o.started;
+        }
+        return *this;
+    }
+    ~events() { if (h) h.destroy(); }
+
+    /* Decodes the first batch; there is only one pass */
+    iterator begin()
+    {
+        if (!started) {
+            started = true;
+            next(h);
+        }
+        return iterator(h);
+    }
+    std::default_sentinel_t end() const { return {}; }
+
+    int format() const { return h.promise().format; }
+    int ntrks() const { return h.promise().ntrks; }
+    int division() const { return h.promise().division; }
+    const char *error() const
+    {
+        return h.promise().failed ? h.promise().err.c_str() : nullptr;
+    }
+
+private:
+    handle h;
+    bool started = false;
+
+    explicit events(handle h) : h(h) {}
+
+    /* resume the decoder until it has a batch with events or is done */
+    static void next(handle h)
+    {
+        do
+            h.resume();
+        while (!h.done() && h.promise().batch->empty());
+    }
+};
+
+namespace detail {
+
+/* In is const input & or, for read_events(input &&), input itself */
+template <class In>
+events run(In in, std::size_t batchsize, int nomerge)
+{
+    collector c;
+    bool more;
+
+    c.set_nomerge(nomerge);
+    c.batch.reserve(batchsize + 2);
+    c.start(in);
+    do {
+        more = c.decode(batchsize);
+        c.resolve();
+        co_yield c;
+        c.clear();
+    } while (more);
+}
+
+}
+
+/*
+ * The events of in, which must stay there until the events are done;
+ * nomerge is as in set_nomerge().
+ */
+inline events read_events(const input &in, std::size_t batchsize = 1024,
+        int nomerge = 0)
+{
+    return detail::run<const input &>(in, batchsize ? batchsize : 1, nomerge);
+}
+
+/* The same, keeping a temporary input, e.g. read_events(mf::input(name)) */
+inline events read_events(input &&in, std::size_t batchsize = 1024,
+        int nomerge = 0)
+{
+    return detail::run<input>(std::move(in), batchsize ? batchsize : 1,
+            nomerge);
+}
+
+}
+
+#endif
@@ -8,25 +8,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 //#include <unistd.h>
 #include <io.h>
 #include <errno.h>
-#include "midifile.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#endif
+#include "mf2t.h"
+#include "mtime.h"
 #include "version.h"
 #include "getopt.h"
 
 
 
-static int TrkNr;
-static int TrksToDo = 1;
-static int Measure, M0, Beat, Clicks;
-static long T0;
+int TrkNr;
+int TrksToDo = 1;
+static struct mtime Mt;
 
 /* options */
 
 static int fold = 0;		/* fold long lines */
 static int notes = 0;		/* print notes as a–g */
 static int times = 0;		/* print times as Measure/beat/click */
+static int json = 0;		/* write events as JSON objects */
+static int columns = 0;		/* write events as binary columns */
+static int csv = 0;		/* write events as CSV rows */
+static int tokens = 0;		/* write events as binary tokens */
+static int stats = 0;		/* write a summary only */
+static char *from = NULL;	/* start of the time window */
+static char *to = NULL;		/* end of the time window */
+static char *indexfile = NULL;	/* write an index of the text here */
+
+static unsigned long long Textpos;	/* bytes of text written */
+static unsigned long long Textline = 1;	/* and the line being written */
 
 static char *Onmsg  = "On ch=%d n=%s v=%d\n";
 static char *Offmsg = "Off ch=%d n=%s v=%d\n";
@@ -44,78 +59,167 @@ static void error(char *s)
         fprintf(stderr, "Error: %s\n", s);
 }
 
+/* All text is written through here, so the index knows where it is */
+static void textout(char *p, long n)
+{
+    char *q, *end = p + n;
+
+    fwrite(p, 1, n, stdout);
+    Textpos += n;
+    for (q = p; (q = memchr(q, '\n', end - q)) != NULL; q++)
+        Textline++;
+}
+
+/* a newline can only be at the end of the format */
+static void tprintf(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        Textpos += n;
+    if (*fmt && fmt[strlen(fmt) - 1] == '\n')
+        Textline++;
+}
+
+/* an index checkpoint for the line that starts here */
+static void idxmark(long tick)
+{
+    long bar = 0, beat, click;
+
+    if (!(Mt.clicks & 0x8000))
+        mt_position(&Mt, tick, &bar, &beat, &click);
+    idxpoint(TrkNr, bar, tick, Textpos, Textline);
+}
+
 static void prtime(void)
 {
+    if (idxdue(Textpos))
+        idxmark(Mf_currtime);
     if (times) {
-        long m = (Mf_currtime-T0)/Beat;
-        printf("%ld:%ld:%ld ",
-                m/Measure+M0, m%Measure, (Mf_currtime-T0)%Beat);
+        long bar, beat, click;
+        mt_position(&Mt, Mf_currtime, &bar, &beat, &click);
+        tprintf("%ld:%ld:%ld ", bar, beat, click);
     } else
-        printf("%ld ",Mf_currtime);
+        tprintf("%ld ",Mf_currtime);
 }
 
+#define OUTCHUNK	4096	/* bytes per fwrite of a string or hex dump */
+
+/*
+ * Runs of characters that need no escape are copied in one piece, up
+ * to the fold position; the string is written with fwrite in chunks.
+ */
 static void prtext(unsigned char *p, int leng)
 {
-    int n, c;
+    char buf[OUTCHUNK + 2];
+    char *end = buf + OUTCHUNK;
+    char *q = buf;
     int pos = 25;
+    int k, c;
 
-    printf("\"");
-    for (n = 0; n < leng; n++) {
-        c = *p++;
+    *q++ = '"';
+    while (leng > 0) {
+        if (end - q < 8) {
+            textout(buf, q - buf);
+            q = buf;
+        }
         if (fold && pos >= fold) {
-            printf("\\\n\t");
+            *q++ = '\\';
+            *q++ = '\n';
+            *q++ = '\t';
             pos = 13;	/* tab + \xab + \ */
-            if (c == ' ' || c == '\t') {
-                putchar('\\');
+            if (*p == ' ' || *p == '\t') {
+                *q++ = '\\';
                 ++pos;
             }
         }
+        k = plainrun(p, leng);
+        if (k > 0) {
+            if (fold && k > fold - pos)
+                k = fold - pos > 0 ? fold - pos : 1;
+            if (k > end - q)
+                k = end - q;
+            memcpy(q, p, k);
+            q += k;
+            p += k;
+            leng -= k;
+            pos += k;
+            continue;
+        }
+        c = *p++;
+        leng--;
+        *q++ = '\\';
         switch (c) {
             case '\\':
             case '"':
-                printf("\\%c", c);
+                *q++ = c;
                 pos += 2;
                 break;
             case '\r':
-                printf("\\r");
+                *q++ = 'r';
                 pos += 2;
                 break;
             case '\n':
-                printf("\\n");
+                *q++ = 'n';
                 pos += 2;
                 break;
             case '\0':
-                printf("\\0");
+                *q++ = '0';
                 pos += 2;
                 break;
             default:
-                if (c >= 0x20) {
-                    putchar(c);
-                    ++pos;
-                } else {
-                    printf("\\x%02x" , c);
-                    pos += 4;
-                }
+                sprintf(q, "x%02x", c);
+                q += 3;
+                pos += 4;
         }
     }
-    printf("\"\n");
+    *q++ = '"';
+    *q++ = '\n';
+    textout(buf, q - buf);
 }
 
+/*
+ * The dump is built in a buffer and written with fwrite, in runs of
+ * bytes that fit on the current line.
+ */
 static void prhex(unsigned char *p,  int leng)
 {
-    int n;
+    char buf[3*OUTCHUNK + 1];
+    char *end = buf + 3*OUTCHUNK;
+    char *q = buf;
     int pos = 25;
+    int k;
 
-    for (n = 0; n < leng; n++, p++) {
+    while (leng > 0) {
+        if (end - q < 8) {
+            textout(buf, q - buf);
+            q = buf;
+        }
         if (fold && pos >= fold) {
-            printf("\\\n\t%02x", *p);
+            *q++ = '\\';
+            *q++ = '\n';
+            q = hexexpand(q, p++, 1);
+            q[-3] = '\t';
+            leng--;
             pos = 14;	/* tab + ab + " ab" + \ */
-        } else {
-            printf(" %02x" , *p);
-            pos += 3;
+            continue;
         }
+        k = leng;
+        if (fold && k > (fold - pos + 2) / 3)
+            k = (fold - pos + 2) / 3;
+        if (k > (end - q) / 3)
+            k = (end - q) / 3;
+        q = hexexpand(q, p, k);
+        p += k;
+        leng -= k;
+        pos += 3*k;
     }
-    printf("\n");
+    *q++ = '\n';
+    textout(buf, q - buf);
 }
 
 static char *mknote(int pitch)
@@ -131,94 +235,134 @@ static char *mknote(int pitch)
     return buf;
 }
 
-static void myheader(int format, int ntrks, int division)
+void setheader(int format, int ntrks, int division)
 {
-    if (division & 0x8000) { /* SMPTE */
+    if (division & 0x8000) /* SMPTE */
         times = 0; /* Can’t do beats */
-        printf("MFile %d %d %d %d\n",format,ntrks,
-                -((-(division>>8))&0xff), division&0xff);
-    } else
-        printf("MFile %d %d %d\n",format,ntrks,division);
     if (format > 2) {
         fprintf(stderr, "Can’t deal with format %d files\n", format);
         exit (1);
     }
-    Beat = Clicks = division;
+    mt_init(&Mt, division);
     TrksToDo = ntrks;
 }
 
+/*
+ * keep the bar:beat:click bookkeeping up to date; a time signature
+ * that has no bars or beats counts as 4/4
+ */
+void settimesig(int nn, int denom)
+{
+    if (nn <= 0 || denom <= 0 || 4 * Mt.clicks / denom == 0) {
+        nn = 4;
+        denom = 4;
+    }
+    mt_timesig(&Mt, Mf_currtime, nn, denom);
+}
+
+/* 1 if the times are written as bar:beat:click */
+int bartimes(void)
+{
+    return times;
+}
+
+/* around events that are not written at their own time */
+static struct mtime Savedmt;
+
+void savetimes(void)
+{
+    Savedmt = Mt;
+}
+
+void restoretimes(void)
+{
+    Mt = Savedmt;
+}
+
+static void myheader(int format, int ntrks, int division)
+{
+    if (division & 0x8000) /* SMPTE */
+        tprintf("MFile %d %d %d %d\n",format,ntrks,
+                -((-(division>>8))&0xff), division&0xff);
+    else
+        tprintf("MFile %d %d %d\n",format,ntrks,division);
+    setheader(format, ntrks, division);
+}
+
 static void mytrstart(void)
 {
-    printf("MTrk\n");
     TrkNr ++;
+    if (indexfile)
+        idxmark(0);
+    tprintf("MTrk\n");
 }
 
 static void mytrend(void)
 {
-    printf("TrkEnd\n");
+    tprintf("TrkEnd\n");
     --TrksToDo;
 }
 
 static void mynon(int chan, int pitch, int vol)
 {
     prtime();
-    printf(Onmsg, chan+1, mknote(pitch), vol);
+    tprintf(Onmsg, chan+1, mknote(pitch), vol);
 }
 
 static void mynoff(int chan, int pitch, int vol)
 {
     prtime();
-    printf(Offmsg, chan+1, mknote(pitch), vol);
+    tprintf(Offmsg, chan+1, mknote(pitch), vol);
 }
 
 static void mypressure(int chan, int pitch, int press)
 {
     prtime();
-    printf(PoPrmsg, chan+1, mknote(pitch), press);
+    tprintf(PoPrmsg, chan+1, mknote(pitch), press);
 }
 
 static void myparameter(int chan, int control, int value)
 {
     prtime();
-    printf(Parmsg, chan+1, control, value);
+    tprintf(Parmsg, chan+1, control, value);
 }
 
 static void mypitchbend(int chan, int lsb, int msb)
 {
     prtime();
-    printf(Pbmsg, chan+1, 128*msb+lsb);
+    tprintf(Pbmsg, chan+1, 128*msb+lsb);
 }
 
 static void myprogram(int chan, int program)
 {
     prtime();
-    printf(PrChmsg, chan+1, program);
+    tprintf(PrChmsg, chan+1, program);
 }
 
 static void mychanpressure(int chan, int press)
 {
     prtime();
-    printf(ChPrmsg, chan+1, press);
+    tprintf(ChPrmsg, chan+1, press);
 }
 
 static void mysysex(int leng, char *mess)
 {
     prtime();
-    printf("SysEx");
+    tprintf("SysEx");
     prhex((unsigned char *)mess, leng);
 }
 
 static void mymmisc(int type, int leng, char *mess)
 {
     prtime();
-    printf("Meta 0x%02x",type);
+    tprintf("Meta 0x%02x",type);
     prhex((unsigned char *)mess, leng);
 }
 
 static void mymspecial(int leng, char *mess)
 {
     prtime();
-    printf("SeqSpec");
+    tprintf("SeqSpec");
     prhex((unsigned char *)mess, leng);
 }
 
@@ -239,36 +383,36 @@ static void mymtext(int type, int leng, char *mess)
 
     prtime();
     if (type < 1 || type > unrecognized)
-        printf("Meta 0x%02x ",type);
+        tprintf("Meta 0x%02x ",type);
     else if (type == 3 && TrkNr == 1)
-        printf("Meta SeqName ");
+        tprintf("Meta SeqName ");
     else
-        printf("Meta %s ",ttype[type]);
+        tprintf("Meta %s ",ttype[type]);
     prtext((unsigned char *)mess, leng);
 }
 
 static void mymseq(int num)
 {
     prtime();
-    printf("SeqNr %d\n",num);
+    tprintf("SeqNr %d\n",num);
 }
 
 static void mymeot(void)
 {
     prtime();
-    printf("Meta TrkEnd\n");
+    tprintf("Meta TrkEnd\n");
 }
 
 static void mykeysig(int sf, int mi)
 {
     prtime();
-    printf("KeySig %d %s\n", (sf>127?sf-256:sf), (mi?"minor":"major"));
+    tprintf("KeySig %d %s\n", (sf>127?sf-256:sf), (mi?"minor":"major"));
 }
 
 static void mytempo(long tempo)
 {
     prtime();
-    printf("Tempo %ld\n",tempo);
+    tprintf("Tempo %ld\n",tempo);
 }
 
 static void mytimesig(int nn, int dd, int cc, int bb)
@@ -277,23 +421,20 @@ static void mytimesig(int nn, int dd, int cc, int bb)
     while (dd-- > 0)
         denom *= 2;
     prtime();
-    printf("TimeSig %d/%d %d %d\n", nn,denom,cc,bb);
-    M0 += (Mf_currtime-T0)/(Beat*Measure);
-    T0 = Mf_currtime;
-    Measure = nn;
-    Beat = 4 * Clicks / denom;
+    tprintf("TimeSig %d/%d %d %d\n", nn,denom,cc,bb);
+    settimesig(nn, denom);
 }
 
 static void mysmpte(int hr, int mn, int se, int fr, int ff)
 {
     prtime();
-    printf("SMPTE %d %d %d %d %d\n", hr, mn, se, fr, ff);
+    tprintf("SMPTE %d %d %d %d %d\n", hr, mn, se, fr, ff);
 }
 
 static void myarbitrary(int leng, char *mess)
 {
     prtime();
-    printf("Arb");
+    tprintf("Arb");
     prhex ((unsigned char *)mess, leng);
 }
 
@@ -328,13 +469,23 @@ static void usage(void)
 {
     fprintf(stderr,
 "mf2t v%s\n"
-"Usage: mf2t [-mnbtv] [-f n] [midifile [textfile]]\n\n"
+"Usage: mf2t [-mnbtvjcaTS] [-f n] [-s time] [-e time] [-i indexfile]\n"
+"            [midifile [textfile]]\n\n"
 "Options:\n"
 "  -m      merge partial sysex into a single sysex message\n"
 "  -n      write notes in symbolic form\n"
 "  -b|-t   write event times as bar:beat:click\n"
 "  -v      use slightly more verbose output\n"
-"  -f n    fold long text and hex entries at n characters\n", VERSION);
+"  -j      write events as JSON objects, one per line\n"
+"  -c      write events as CSV rows (as midicsv does)\n"
+"  -a      write events as binary columnar arrays\n"
+"  -T      write events as binary tokens that t2mf reads back\n"
+"  -S      write a summary of the file only (as JSON with -j)\n"
+"  -f n    fold long text and hex entries at n characters\n"
+"  -s time  only write events from this time on (ticks, bar:beat:click,\n"
+"           or seconds as in 30s), preceded by the state at that time\n"
+"  -e time  only write events before this time\n"
+"  -i file  write an index of the lines of the text to file\n", VERSION);
     exit(1);
 }
 
@@ -343,7 +494,7 @@ int main(int argc, char **argv)
     int c;
 
     Mf_nomerge = 1;
-    while ((c = getopt(argc, argv, "mnbtvf:h")) != -1) {
+    while ((c = getopt(argc, argv, "mnbtvjcaTSf:s:e:i:h")) != -1) {
         switch (c) {
             case 'm':
                 Mf_nomerge = 0;
@@ -364,9 +515,33 @@ int main(int argc, char **argv)
                 PrChmsg = "ProgCh ch=%d prog=%d\n";
                 ChPrmsg = "ChanPr ch=%d val=%d\n";
                 break;
+            case 'j':
+                json++;
+                break;
+            case 'c':
+                csv++;
+                break;
+            case 'a':
+                columns++;
+                break;
+            case 'T':
+                tokens++;
+                break;
+            case 'S':
+                stats++;
+                break;
             case 'f':
                 fold = atoi(optarg);
                 break;
+            case 's':
+                from = optarg;
+                break;
+            case 'e':
+                to = optarg;
+                break;
+            case 'i':
+                indexfile = optarg;
+                break;
             case 'h':
             case '?':
             default:
@@ -374,7 +549,14 @@ int main(int argc, char **argv)
         }
     }
 
-	char * temp = argv[optind];
+    /* one output mode; -j also gives the summary as JSON */
+    if ((json != 0) + (csv != 0) + (columns != 0) + (tokens != 0) > 1 ||
+            (stats && (csv || columns || tokens)))
+        usage();
+    if (indexfile && (json || csv || columns || tokens || stats))
+        usage();	/* only the text has lines */
+
+    char * temp = argv[optind];
 
     if (optind < argc && !freopen(argv[optind++], "rb", stdin)) {
         fprintf(stderr, "freopen (%s): %s\n", argv[optind - 1],
@@ -382,20 +564,48 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    if (optind < argc && !freopen(argv[optind], "w", stdout)) {
+    if (optind < argc && !freopen(argv[optind],
+                columns || tokens || indexfile ? "wb" : "w", stdout)) {
         fprintf(stderr, "freopen (%s): %s\n", argv[optind],
                 strerror(errno));
         exit(1);
     }
 
+#ifdef _WIN32
+    if (columns || tokens || indexfile)	/* the offsets must be exact */
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
     initfuncs();
+    if (json)
+        initjson();
+    if (csv)
+        initcsv();
+    if (columns)
+        initcol();
+    if (tokens)
+        inittok();
+    if (stats)
+        initstat(json);
+    if (from || to) {
+        if (!setwindow(from, to))
+            usage();
+        initwindow();
+    }
+    if (indexfile)
+        idxopen(indexfile);
+    atexit(outflush);
     TrkNr = 0;
-    Measure = 4;
-    Beat = 96;
-    Clicks = 96;
-    T0 = 0;
-    M0 = 0;
+    mt_init(&Mt, 96);
     mfread();
+    if (indexfile)
+        idxclose();
+    if (csv)
+        csvfinish();
+    if (columns)
+        colfinish();
+    if (stats)
+        statfinish();
 
     return 0;
 }
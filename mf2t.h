@@ -0,0 +1,64 @@
+#ifndef MF2T_H
+#define MF2T_H
+
+/*
+ * Definitions shared between mf2t and its output modules.
+ */
+#include "midifile.h"
+
+/* mf2t.c */
+extern int TrkNr;
+extern int TrksToDo;
+extern void setheader(int format, int ntrks, int division);
+extern void settimesig(int nn, int denom);
+extern int bartimes(void);
+extern void savetimes(void);
+extern void restoretimes(void);
+
+/* mf2tout.c – buffered output, written with fwrite to stdout */
+#define OUTBUFSIZ	16384
+
+extern char Outbuf[];
+extern char *Outp;
+
+#define outroom(n)	do { if (Outp + (n) > Outbuf + OUTBUFSIZ) outflush(); } while (0)
+#define outc(c)		do { outroom(1); *Outp++ = (c); } while (0)
+
+extern void outflush(void);
+extern void outmem(const char *s, int n);
+extern void outs(const char *s);
+extern void outdec(long v);
+extern void outhex(unsigned char *p, int leng);
+extern char *hexexpand(char *d, unsigned char *p, int leng);
+extern int plainrun(unsigned char *p, int leng);
+
+/* mf2tjson.c */
+extern void initjson(void);
+
+/* mf2tcsv.c */
+extern void initcsv(void);
+extern void csvfinish(void);
+
+/* mf2twin.c */
+extern int setwindow(char *from, char *to);
+extern void initwindow(void);
+
+/* mf2tstat.c */
+extern void initstat(int json);
+extern void statfinish(void);
+
+/* mf2tcol.c */
+extern void initcol(void);
+extern void colfinish(void);
+
+/* mf2ttok.c */
+extern void inittok(void);
+
+/* mf2tidx.c */
+extern void idxopen(char *name);
+extern int idxdue(unsigned long long pos);
+extern void idxpoint(int track, long bar, unsigned long tick,
+        unsigned long long pos, unsigned long long line);
+extern void idxclose(void);
+
+#endif
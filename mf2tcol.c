@@ -0,0 +1,319 @@
+/*
+ * mf2tcol
+ *
+ * Columnar binary output for mf2t (-a).  All events of the file are
+ * collected in one fixed‐width array per field and written at the end,
+ * preceded by a header giving the position of every array, so that the
+ * result can be memory‐mapped (e.g. with numpy.memmap) and scanned
+ * without any parsing.
+ *
+ * All numbers are little‐endian.  The file starts with a 96 byte header:
+ *
+ *      0   8   magic "MF2TCOL1"
+ *      8   2   format
+ *     10   2   number of tracks
+ *     12   2   division, as in the MThd chunk
+ *     14   2   zero
+ *     16   8   n, the number of events
+ *     24   8   size of the payload blob in bytes
+ *     32   8   offset of track     uint16[n]   (1 for the first track)
+ *     40   8   offset of tick      uint32[n]   (absolute time)
+ *     48   8   offset of status    uint8[n]
+ *     56   8   offset of data1     uint8[n]
+ *     64   8   offset of data2     uint8[n]
+ *     72   8   offset of payload   uint32[n+1] (offsets into the blob)
+ *     80   8   offset of the blob
+ *     88   8   zero
+ *
+ * The 8 byte fields are full 64 bit numbers.  The payload offsets are
+ * 32 bits, so the blob can hold at most 4 GB; mf2t stops with an error
+ * when a file has more than that.
+ *
+ * Every array starts at a multiple of 8 bytes.  status is the MIDI
+ * status byte: 0x80–0xef for channel messages (with the channel in the
+ * low nibble), 0xf0 for sysex, 0xf7 for arbitrary data and 0xff for meta
+ * events.  For channel messages data1 and data2 are the data bytes as
+ * in the file (for pitch bend: LSB, MSB), for meta events data1 is the
+ * meta type.  The payload of event i is blob[payload[i]..payload[i+1]];
+ * it holds the sysex bytes (including the leading f0), the arbitrary
+ * bytes or the data of the meta event, and is empty for channel messages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mf2t.h"
+
+#define COLHDRSIZE	96
+
+struct column {
+    unsigned char *p;
+    size_t len;
+    size_t size;
+};
+
+static struct column Trk, Tick, Status, Data1, Data2, Payload, Blob;
+static unsigned long long Nevents;
+static int Format, Ntrks, Division;
+
+static void colgrow(struct column *col, size_t n)
+{
+    if (col->len + n <= col->size)
+        return;
+    if (col->size == 0)
+        col->size = 4096;
+    while (col->len + n > col->size)
+        col->size *= 2;
+    col->p = realloc(col->p, col->size);
+    if (col->p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+/* append an n byte little-endian number */
+static void colput(struct column *col, unsigned long v, int n)
+{
+    unsigned char *p;
+
+    colgrow(col, n);
+    p = col->p + col->len;
+    col->len += n;
+    while (n-- > 0) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static void colevent(int status, int c1, int c2, unsigned char *mess, int leng)
+{
+    colput(&Trk, TrkNr, 2);
+    colput(&Tick, Mf_currtime, 4);
+    colput(&Status, status, 1);
+    colput(&Data1, c1 & 0xff, 1);
+    colput(&Data2, c2 & 0xff, 1);
+    if (leng > 0) {
+        if (Blob.len + leng > 0xffffffffUL) {
+            fprintf(stderr, "More than 4 GB of payload for -a\n");
+            exit(1);
+        }
+        colgrow(&Blob, leng);
+        memcpy(Blob.p + Blob.len, mess, leng);
+        Blob.len += leng;
+    }
+    colput(&Payload, Blob.len, 4);
+    Nevents++;
+}
+
+static void colheader(int format, int ntrks, int division)
+{
+    Format = format;
+    Ntrks = ntrks;
+    Division = division;
+    setheader(format, ntrks, division);
+    colput(&Payload, 0, 4);
+}
+
+static void coltrstart(void)
+{
+    TrkNr ++;
+}
+
+static void coltrend(void)
+{
+    --TrksToDo;
+}
+
+static void colnon(int chan, int pitch, int vol)
+{
+    colevent(note_on | chan, pitch, vol, NULL, 0);
+}
+
+static void colnoff(int chan, int pitch, int vol)
+{
+    colevent(note_off | chan, pitch, vol, NULL, 0);
+}
+
+static void colpressure(int chan, int pitch, int press)
+{
+    colevent(poly_aftertouch | chan, pitch, press, NULL, 0);
+}
+
+static void colparameter(int chan, int control, int value)
+{
+    colevent(control_change | chan, control, value, NULL, 0);
+}
+
+static void colpitchbend(int chan, int lsb, int msb)
+{
+    colevent(pitch_wheel | chan, lsb, msb, NULL, 0);
+}
+
+static void colprogram(int chan, int program)
+{
+    colevent(program_chng | chan, program, 0, NULL, 0);
+}
+
+static void colchanpressure(int chan, int press)
+{
+    colevent(channel_aftertouch | chan, press, 0, NULL, 0);
+}
+
+static void colsysex(int leng, char *mess)
+{
+    colevent(system_exclusive, 0, 0, (unsigned char *)mess, leng);
+}
+
+static void colarbitrary(int leng, char *mess)
+{
+    colevent(0xf7, 0, 0, (unsigned char *)mess, leng);
+}
+
+static void colmeta(int type, int leng, char *mess)
+{
+    colevent(meta_event, type, 0, (unsigned char *)mess, leng);
+}
+
+static void colmspecial(int leng, char *mess)
+{
+    colmeta(sequencer_specific, leng, mess);
+}
+
+/*
+ * The library decodes the following meta events into numbers; the
+ * original data bytes are put together again for the payload.
+ */
+static void colmseq(int num)
+{
+    char m[2];
+
+    m[0] = num >> 8;
+    m[1] = num;
+    colmeta(sequence_number, 2, m);
+}
+
+static void colmeot(void)
+{
+    colmeta(end_of_track, 0, NULL);
+}
+
+static void colkeysig(int sf, int mi)
+{
+    char m[2];
+
+    m[0] = sf;
+    m[1] = mi;
+    colmeta(key_signature, 2, m);
+}
+
+static void coltempo(long tempo)
+{
+    char m[3];
+
+    m[0] = tempo >> 16;
+    m[1] = tempo >> 8;
+    m[2] = tempo;
+    colmeta(set_tempo, 3, m);
+}
+
+static void coltimesig(int nn, int dd, int cc, int bb)
+{
+    char m[4];
+
+    m[0] = nn;
+    m[1] = dd;
+    m[2] = cc;
+    m[3] = bb;
+    colmeta(time_signature, 4, m);
+}
+
+static void colsmpte(int hr, int mn, int se, int fr, int ff)
+{
+    char m[5];
+
+    m[0] = hr;
+    m[1] = mn;
+    m[2] = se;
+    m[3] = fr;
+    m[4] = ff;
+    colmeta(smpte_offset, 5, m);
+}
+
+static void outle(unsigned long long v, int n)
+{
+    outroom(n);
+    while (n-- > 0) {
+        *Outp++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/* write a column and pad it to a multiple of 8 bytes */
+static void outcol(struct column *col)
+{
+    size_t off, n;
+
+    for (off = 0; off < col->len; off += n) {
+        n = col->len - off < OUTBUFSIZ ? col->len - off : OUTBUFSIZ;
+        outmem((char *)col->p + off, (int)n);
+    }
+    outle(0, (8 - col->len % 8) % 8);
+}
+
+#define align8(n)	(((n) + 7) & ~(size_t)7)
+
+void colfinish(void)
+{
+    struct column *cols[7];
+    unsigned long long off;
+    int i;
+
+    cols[0] = &Trk;
+    cols[1] = &Tick;
+    cols[2] = &Status;
+    cols[3] = &Data1;
+    cols[4] = &Data2;
+    cols[5] = &Payload;
+    cols[6] = &Blob;
+
+    outmem("MF2TCOL1", 8);
+    outle(Format, 2);
+    outle(Ntrks, 2);
+    outle(Division, 2);
+    outle(0, 2);
+    outle(Nevents, 8);
+    outle(Blob.len, 8);
+    off = COLHDRSIZE;
+    for (i = 0; i < 7; i++) {
+        outle(off, 8);
+        off += align8(cols[i]->len);
+    }
+    outle(0, 8);
+    for (i = 0; i < 7; i++)
+        outcol(cols[i]);
+}
+
+void initcol(void)
+{
+    Mf_header =  colheader;
+    Mf_starttrack =  coltrstart;
+    Mf_endtrack =  coltrend;
+    Mf_on =  colnon;
+    Mf_off =  colnoff;
+    Mf_pressure =  colpressure;
+    Mf_parameter =  colparameter;
+    Mf_pitchbend =  colpitchbend;
+    Mf_program =  colprogram;
+    Mf_chanpressure =  colchanpressure;
+    Mf_sysex =  colsysex;
+    Mf_metamisc =  colmeta;
+    Mf_seqnum =  colmseq;
+    Mf_eot =  colmeot;
+    Mf_timesig =  coltimesig;
+    Mf_smpte =  colsmpte;
+    Mf_tempo =  coltempo;
+    Mf_keysig =  colkeysig;
+    Mf_sqspecific =  colmspecial;
+    Mf_text =  colmeta;
+    Mf_arbitrary =  colarbitrary;
+}
@@ -0,0 +1,283 @@
+/*
+ * mf2tcsv
+ *
+ * CSV output for mf2t (-c), in the row layout used by midicsv/csvmidi:
+ * one row per event, starting with the track number and absolute time,
+ * followed by the event name and a fixed list of fields for that type.
+ * Channels are counted from 0 in this format.  Strings are quoted
+ * according to RFC 4180 (an embedded " is doubled); a backslash is
+ * written as \\ and bytes that are not printable ISO 8859‐1 as \ooo.
+ */
+
+#include <stdio.h>
+#include "mf2t.h"
+
+static void csvbegin(char *type)
+{
+    outdec(TrkNr);
+    outs(", ");
+    outdec(Mf_currtime);
+    outs(", ");
+    outs(type);
+}
+
+static void csvint(long val)
+{
+    outs(", ");
+    outdec(val);
+}
+
+static void csvend(void)
+{
+    outc('\n');
+}
+
+static void csvbytes(unsigned char *p, int leng)
+{
+    csvint(leng);
+    while (leng-- > 0)
+        csvint(*p++);
+}
+
+static void csvtext(unsigned char *p, int leng)
+{
+    int c;
+
+    outs(", \"");
+    while (leng-- > 0) {
+        c = *p++;
+        outroom(4);
+        if (c == '"') {
+            *Outp++ = '"';
+            *Outp++ = '"';
+        } else if (c == '\\') {
+            *Outp++ = '\\';
+            *Outp++ = '\\';
+        } else if ((c >= 0x20 && c < 0x7f) || c >= 0xa0)
+            *Outp++ = c;
+        else {
+            *Outp++ = '\\';
+            *Outp++ = '0' + (c >> 6);
+            *Outp++ = '0' + ((c >> 3) & 7);
+            *Outp++ = '0' + (c & 7);
+        }
+    }
+    outc('"');
+}
+
+static void csvheader(int format, int ntrks, int division)
+{
+    outs("0, 0, Header");
+    csvint(format);
+    csvint(ntrks);
+    csvint(division);
+    csvend();
+    setheader(format, ntrks, division);
+}
+
+static void csvtrstart(void)
+{
+    TrkNr ++;
+    csvbegin("Start_track");
+    csvend();
+}
+
+static void csvtrend(void)
+{
+    --TrksToDo;
+}
+
+static void csvnote(char *type, int chan, int pitch, int vol)
+{
+    csvbegin(type);
+    csvint(chan);
+    csvint(pitch);
+    csvint(vol);
+    csvend();
+}
+
+static void csvnon(int chan, int pitch, int vol)
+{
+    csvnote("Note_on_c", chan, pitch, vol);
+}
+
+static void csvnoff(int chan, int pitch, int vol)
+{
+    csvnote("Note_off_c", chan, pitch, vol);
+}
+
+static void csvpressure(int chan, int pitch, int press)
+{
+    csvnote("Poly_aftertouch_c", chan, pitch, press);
+}
+
+static void csvparameter(int chan, int control, int value)
+{
+    csvnote("Control_c", chan, control, value);
+}
+
+static void csvpitchbend(int chan, int lsb, int msb)
+{
+    csvbegin("Pitch_bend_c");
+    csvint(chan);
+    csvint(128*msb+lsb);
+    csvend();
+}
+
+static void csvprogram(int chan, int program)
+{
+    csvbegin("Program_c");
+    csvint(chan);
+    csvint(program);
+    csvend();
+}
+
+static void csvchanpressure(int chan, int press)
+{
+    csvbegin("Channel_aftertouch_c");
+    csvint(chan);
+    csvint(press);
+    csvend();
+}
+
+/* the leading f0 is implied by the row type */
+static void csvsysex(int leng, char *mess)
+{
+    csvbegin("System_exclusive");
+    csvbytes((unsigned char *)mess+1, leng-1);
+    csvend();
+}
+
+static void csvarbitrary(int leng, char *mess)
+{
+    csvbegin("System_exclusive_packet");
+    csvbytes((unsigned char *)mess, leng);
+    csvend();
+}
+
+static void csvmspecial(int leng, char *mess)
+{
+    csvbegin("Sequencer_specific");
+    csvbytes((unsigned char *)mess, leng);
+    csvend();
+}
+
+static void csvmmisc(int type, int leng, char *mess)
+{
+    unsigned char *m = (unsigned char *)mess;
+
+    if (type == channel_prefix && leng == 1) {
+        csvbegin("Channel_prefix");
+        csvint(m[0]);
+    } else if (type == 0x21 && leng == 1) {
+        csvbegin("MIDI_port");
+        csvint(m[0]);
+    } else {
+        csvbegin("Unknown_meta_event");
+        csvint(type);
+        csvbytes(m, leng);
+    }
+    csvend();
+}
+
+static void csvmtext(int type, int leng, char *mess)
+{
+    static char *ttype[] = {
+        NULL,
+        "Text_t",               /* type=0x01 */
+        "Copyright_t",          /* type=0x02 */
+        "Title_t",
+        "Instrument_name_t",    /* ...       */
+        "Lyric_t",
+        "Marker_t",
+        "Cue_point_t",          /* type=0x07 */
+    };
+    int known = (sizeof(ttype)/sizeof(char *)) - 1;
+
+    if (type < 1 || type > known) {
+        csvmmisc(type, leng, mess);
+        return;
+    }
+    csvbegin(ttype[type]);
+    csvtext((unsigned char *)mess, leng);
+    csvend();
+}
+
+static void csvmseq(int num)
+{
+    csvbegin("Sequence_number");
+    csvint(num);
+    csvend();
+}
+
+static void csvmeot(void)
+{
+    csvbegin("End_track");
+    csvend();
+}
+
+static void csvkeysig(int sf, int mi)
+{
+    csvbegin("Key_signature");
+    csvint(sf>127?sf-256:sf);
+    outs(mi ? ", \"minor\"" : ", \"major\"");
+    csvend();
+}
+
+static void csvtempo(long tempo)
+{
+    csvbegin("Tempo");
+    csvint(tempo);
+    csvend();
+}
+
+static void csvtimesig(int nn, int dd, int cc, int bb)
+{
+    csvbegin("Time_signature");
+    csvint(nn);
+    csvint(dd);
+    csvint(cc);
+    csvint(bb);
+    csvend();
+}
+
+static void csvsmpte(int hr, int mn, int se, int fr, int ff)
+{
+    csvbegin("SMPTE_offset");
+    csvint(hr);
+    csvint(mn);
+    csvint(se);
+    csvint(fr);
+    csvint(ff);
+    csvend();
+}
+
+void csvfinish(void)
+{
+    outs("0, 0, End_of_file\n");
+}
+
+void initcsv(void)
+{
+    Mf_header =  csvheader;
+    Mf_starttrack =  csvtrstart;
+    Mf_endtrack =  csvtrend;
+    Mf_on =  csvnon;
+    Mf_off =  csvnoff;
+    Mf_pressure =  csvpressure;
+    Mf_parameter =  csvparameter;
+    Mf_pitchbend =  csvpitchbend;
+    Mf_program =  csvprogram;
+    Mf_chanpressure =  csvchanpressure;
+    Mf_sysex =  csvsysex;
+    Mf_metamisc =  csvmmisc;
+    Mf_seqnum =  csvmseq;
+    Mf_eot =  csvmeot;
+    Mf_timesig =  csvtimesig;
+    Mf_smpte =  csvsmpte;
+    Mf_tempo =  csvtempo;
+    Mf_keysig =  csvkeysig;
+    Mf_sqspecific =  csvmspecial;
+    Mf_text =  csvmtext;
+    Mf_arbitrary =  csvarbitrary;
+}
@@ -0,0 +1,99 @@
+/*
+ * mf2tidx
+ *
+ * The index of the text written by mf2t (-i file).  It is a small
+ * binary file of checkpoints, each giving the track, bar and tick of a
+ * line of the text and where that line starts, so that a viewer can go
+ * to a track or a time in a large text without reading it from the
+ * start.
+ *
+ * All numbers are little-endian.  The file starts with a 16 byte header:
+ *
+ *      0   8   magic "MF2TIDX1"
+ *      8   4   size of a checkpoint (32)
+ *     12   4   zero
+ *
+ * followed by the checkpoints:
+ *
+ *      0   4   track (1 for the first)
+ *      4   4   bar, counting from 0 as in bar:beat:click (0 for SMPTE);
+ *              a signed int32, as the bars of a format 1 file run on
+ *              from the last time signature of the tracks before, and
+ *              are negative before it
+ *      8   8   tick
+ *     16   8   offset of the line in the text
+ *     24   8   number of the line, counting from 1
+ *
+ * There is one for the MTrk line of each track and one for the first
+ * event after every IDXSTEP bytes of text.  They are in the order of the
+ * text, so the offsets increase, and within a track the ticks do too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "mf2t.h"
+
+#define IDXSTEP		65536
+#define IDXRECSIZE	32
+
+static FILE *Idx;
+static char *Idxname;
+static unsigned long long Last;	/* the offset of the last checkpoint */
+
+static void putle(unsigned char *p, unsigned long long v, int n)
+{
+    while (n-- > 0) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+void idxopen(char *name)
+{
+    unsigned char hdr[16];
+
+    if ((Idx = fopen(name, "wb")) == NULL) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    Idxname = name;
+    memcpy(hdr, "MF2TIDX1", 8);
+    putle(hdr + 8, IDXRECSIZE, 4);
+    putle(hdr + 12, 0, 4);
+    fwrite(hdr, 1, sizeof(hdr), Idx);
+}
+
+/* Is a checkpoint due for an event line at offset pos? */
+int idxdue(unsigned long long pos)
+{
+    return Idx != NULL && pos - Last >= IDXSTEP;
+}
+
+void idxpoint(int track, long bar, unsigned long tick,
+        unsigned long long pos, unsigned long long line)
+{
+    unsigned char rec[IDXRECSIZE];
+
+    putle(rec, track, 4);
+    /* two's complement; bars beyond 32 bits are not worth more */
+    if (bar > 0x7fffffffL)
+        bar = 0x7fffffffL;
+    if (bar < -0x7fffffffL - 1)
+        bar = -0x7fffffffL - 1;
+    putle(rec + 4, (unsigned long long)bar, 4);
+    putle(rec + 8, tick, 8);
+    putle(rec + 16, pos, 8);
+    putle(rec + 24, line, 8);
+    fwrite(rec, 1, sizeof(rec), Idx);
+    Last = pos;
+}
+
+void idxclose(void)
+{
+    if (ferror(Idx) | fclose(Idx)) {
+        fprintf(stderr, "%s: %s\n", Idxname, strerror(errno));
+        exit(1);
+    }
+}
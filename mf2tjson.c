@@ -0,0 +1,324 @@
+/*
+ * mf2tjson
+ *
+ * JSON output for mf2t (-j).  Every event is written as one JSON object
+ * on a line of its own (newline delimited JSON), so the output can be
+ * streamed into jq or a columnar loader without a custom parser.
+ */
+
+#include <stdio.h>
+#include "mf2t.h"
+
+static void jsbegin(char *type)
+{
+    outs("{\"trk\":");
+    outdec(TrkNr);
+    outs(",\"tick\":");
+    outdec(Mf_currtime);
+    outs(",\"type\":\"");
+    outs(type);
+    outc('"');
+}
+
+static void jsint(char *key, long val)
+{
+    outs(",\"");
+    outs(key);
+    outs("\":");
+    outdec(val);
+}
+
+static void jsstr(char *key, char *val)
+{
+    outs(",\"");
+    outs(key);
+    outs("\":\"");
+    outs(val);
+    outc('"');
+}
+
+static void jsend(void)
+{
+    outs("}\n");
+}
+
+static void jshex(unsigned char *p, int leng)
+{
+    outs(",\"hex\":\"");
+    outhex(p, leng);
+    outc('"');
+}
+
+/*
+ * Text is escaped as a JSON string.  Bytes above 0x7f are written as
+ * \u00xx, i.e. the text is taken to be Latin-1, so that the output is
+ * always valid UTF-8 and the original bytes can be recovered exactly.
+ */
+static void jstext(unsigned char *p, int leng)
+{
+    static char hexdigits[] = "0123456789abcdef";
+    int c;
+
+    outs(",\"text\":\"");
+    while (leng-- > 0) {
+        c = *p++;
+        outroom(6);
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            *Outp++ = c;
+            continue;
+        }
+        *Outp++ = '\\';
+        switch (c) {
+            case '"':
+            case '\\':
+                *Outp++ = c;
+                break;
+            case '\n':
+                *Outp++ = 'n';
+                break;
+            case '\r':
+                *Outp++ = 'r';
+                break;
+            case '\t':
+                *Outp++ = 't';
+                break;
+            default:
+                *Outp++ = 'u';
+                *Outp++ = '0';
+                *Outp++ = '0';
+                *Outp++ = hexdigits[c >> 4];
+                *Outp++ = hexdigits[c & 0xf];
+        }
+    }
+    outc('"');
+}
+
+static void jsheader(int format, int ntrks, int division)
+{
+    outs("{\"type\":\"MFile\"");
+    jsint("format", format);
+    jsint("ntrks", ntrks);
+    if (division & 0x8000) { /* SMPTE */
+        jsint("division", -((-(division>>8))&0xff));
+        jsint("resolution", division&0xff);
+    } else
+        jsint("division", division);
+    jsend();
+    setheader(format, ntrks, division);
+}
+
+static void jstrstart(void)
+{
+    TrkNr ++;
+    outs("{\"trk\":");
+    outdec(TrkNr);
+    outs(",\"type\":\"MTrk\"");
+    jsend();
+}
+
+static void jstrend(void)
+{
+    outs("{\"trk\":");
+    outdec(TrkNr);
+    outs(",\"type\":\"TrkEnd\"");
+    jsend();
+    --TrksToDo;
+}
+
+static void jsnote(char *type, int chan, int pitch, int vol)
+{
+    jsbegin(type);
+    jsint("ch", chan+1);
+    jsint("n", pitch);
+    jsint("v", vol);
+    jsend();
+}
+
+static void jsnon(int chan, int pitch, int vol)
+{
+    jsnote("On", chan, pitch, vol);
+}
+
+static void jsnoff(int chan, int pitch, int vol)
+{
+    jsnote("Off", chan, pitch, vol);
+}
+
+static void jspressure(int chan, int pitch, int press)
+{
+    jsnote("PoPr", chan, pitch, press);
+}
+
+static void jsparameter(int chan, int control, int value)
+{
+    jsbegin("Par");
+    jsint("ch", chan+1);
+    jsint("c", control);
+    jsint("v", value);
+    jsend();
+}
+
+static void jspitchbend(int chan, int lsb, int msb)
+{
+    jsbegin("Pb");
+    jsint("ch", chan+1);
+    jsint("v", 128*msb+lsb);
+    jsend();
+}
+
+static void jsprogram(int chan, int program)
+{
+    jsbegin("PrCh");
+    jsint("ch", chan+1);
+    jsint("p", program);
+    jsend();
+}
+
+static void jschanpressure(int chan, int press)
+{
+    jsbegin("ChPr");
+    jsint("ch", chan+1);
+    jsint("v", press);
+    jsend();
+}
+
+static void jssysex(int leng, char *mess)
+{
+    jsbegin("SysEx");
+    jshex((unsigned char *)mess, leng);
+    jsend();
+}
+
+static void jsarbitrary(int leng, char *mess)
+{
+    jsbegin("Arb");
+    jshex((unsigned char *)mess, leng);
+    jsend();
+}
+
+static void jsmspecial(int leng, char *mess)
+{
+    jsbegin("SeqSpec");
+    jshex((unsigned char *)mess, leng);
+    jsend();
+}
+
+static char *metatype(int type)
+{
+    static char buf[5];
+
+    buf[0] = '0';
+    buf[1] = 'x';
+    buf[2] = "0123456789abcdef"[(type>>4)&0xf];
+    buf[3] = "0123456789abcdef"[type&0xf];
+    buf[4] = '\0';
+    return buf;
+}
+
+static void jsmmisc(int type, int leng, char *mess)
+{
+    jsbegin("Meta");
+    jsstr("meta", metatype(type));
+    jshex((unsigned char *)mess, leng);
+    jsend();
+}
+
+static void jsmtext(int type, int leng, char *mess)
+{
+    static char *ttype[] = {
+        NULL,
+        "Text",         /* type=0x01 */
+        "Copyright",    /* type=0x02 */
+        "TrkName",
+        "InstrName",    /* ...       */
+        "Lyric",
+        "Marker",
+        "Cue",          /* type=0x07 */
+    };
+    int known = (sizeof(ttype)/sizeof(char *)) - 1;
+
+    jsbegin("Meta");
+    if (type < 1 || type > known)
+        jsstr("meta", metatype(type));
+    else if (type == 3 && TrkNr == 1)
+        jsstr("meta", "SeqName");
+    else
+        jsstr("meta", ttype[type]);
+    jstext((unsigned char *)mess, leng);
+    jsend();
+}
+
+static void jsmseq(int num)
+{
+    jsbegin("SeqNr");
+    jsint("num", num);
+    jsend();
+}
+
+static void jsmeot(void)
+{
+    jsbegin("Meta");
+    jsstr("meta", "TrkEnd");
+    jsend();
+}
+
+static void jskeysig(int sf, int mi)
+{
+    jsbegin("KeySig");
+    jsint("sf", (sf>127?sf-256:sf));
+    jsstr("mode", (mi?"minor":"major"));
+    jsend();
+}
+
+static void jstempo(long tempo)
+{
+    jsbegin("Tempo");
+    jsint("tempo", tempo);
+    jsend();
+}
+
+static void jstimesig(int nn, int dd, int cc, int bb)
+{
+    jsbegin("TimeSig");
+    jsint("num", nn);
+    jsint("denom", 1L << (dd & 0x1f));
+    jsint("cc", cc);
+    jsint("bb", bb);
+    jsend();
+}
+
+static void jssmpte(int hr, int mn, int se, int fr, int ff)
+{
+    jsbegin("SMPTE");
+    jsint("hr", hr);
+    jsint("mn", mn);
+    jsint("se", se);
+    jsint("fr", fr);
+    jsint("ff", ff);
+    jsend();
+}
+
+void initjson(void)
+{
+    Mf_header =  jsheader;
+    Mf_starttrack =  jstrstart;
+    Mf_endtrack =  jstrend;
+    Mf_on =  jsnon;
+    Mf_off =  jsnoff;
+    Mf_pressure =  jspressure;
+    Mf_parameter =  jsparameter;
+    Mf_pitchbend =  jspitchbend;
+    Mf_program =  jsprogram;
+    Mf_chanpressure =  jschanpressure;
+    Mf_sysex =  jssysex;
+    Mf_metamisc =  jsmmisc;
+    Mf_seqnum =  jsmseq;
+    Mf_eot =  jsmeot;
+    Mf_timesig =  jstimesig;
+    Mf_smpte =  jssmpte;
+    Mf_tempo =  jstempo;
+    Mf_keysig =  jskeysig;
+    Mf_sqspecific =  jsmspecial;
+    Mf_text =  jsmtext;
+    Mf_arbitrary =  jsarbitrary;
+}
@@ -0,0 +1,317 @@
+/*
+ * mf2tout
+ *
+ * Buffered output for mf2t.  Numbers and hex bytes are formatted by
+ * hand into a fixed buffer which is handed to fwrite when it fills up,
+ * so the output modes never go through printf.
+ *
+ * Hex dumps of long sysex messages are expanded 16 bytes at a time with
+ * SSE2 or SSSE3 where the compiler provides them, and 32 at a time with
+ * AVX2 (the byte shuffle works within each 128 bit lane, so every lane
+ * expands its own 16 bytes and the lanes are put in order when they are
+ * stored).  Text is scanned for characters that need escaping 16 or 32
+ * bytes at a time.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mf2t.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define USE_SSSE3
+#define USE_AVX2
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define USE_SSSE3
+#elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static int firstbit(unsigned long m)
+{
+    unsigned long i;
+
+    _BitScanForward(&i, m);
+    return i;
+}
+#else
+#define firstbit(m)	__builtin_ctz(m)
+#endif
+
+char Outbuf[OUTBUFSIZ];
+char *Outp = Outbuf;
+
+static char Hexdigits[] = "0123456789abcdef";
+
+void outflush(void)
+{
+    if (Outp > Outbuf)
+        fwrite(Outbuf, 1, Outp - Outbuf, stdout);
+    Outp = Outbuf;
+}
+
+void outmem(const char *s, int n)
+{
+    int k;
+
+    while (n > 0) {
+        if (Outp == Outbuf + OUTBUFSIZ)
+            outflush();
+        k = Outbuf + OUTBUFSIZ - Outp;
+        if (k > n)
+            k = n;
+        memcpy(Outp, s, k);
+        Outp += k;
+        s += k;
+        n -= k;
+    }
+}
+
+void outs(const char *s)
+{
+    outmem(s, strlen(s));
+}
+
+void outdec(long v)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    outmem(p, buf + sizeof(buf) - p);
+}
+
+#if defined(USE_SSE2) || defined(USE_SSSE3)
+/* the hex digits of the high and low nibbles of 16 bytes */
+static void hexdigits16(const unsigned char *p, __m128i *hi, __m128i *lo)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_set1_epi8(0x0f);
+    __m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), m);
+    __m128i l = _mm_and_si128(v, m);
+#ifdef USE_SSSE3
+    __m128i lut = _mm_loadu_si128((const __m128i *)Hexdigits);
+
+    *hi = _mm_shuffle_epi8(lut, h);
+    *lo = _mm_shuffle_epi8(lut, l);
+#else
+    __m128i zero = _mm_set1_epi8('0');
+    __m128i nine = _mm_set1_epi8(9);
+    __m128i atof = _mm_set1_epi8('a' - '0' - 10);
+
+    *hi = _mm_add_epi8(_mm_add_epi8(h, zero),
+            _mm_and_si128(_mm_cmpgt_epi8(h, nine), atof));
+    *lo = _mm_add_epi8(_mm_add_epi8(l, zero),
+            _mm_and_si128(_mm_cmpgt_epi8(l, nine), atof));
+#endif
+}
+#endif
+
+#if defined(USE_AVX2)
+static __m256i bcast16(const void *p)
+{
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)p));
+}
+
+/* the hex digits of the high and low nibbles of 32 bytes */
+static void hexdigits32(const unsigned char *p, __m256i *hi, __m256i *lo)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_set1_epi8(0x0f);
+    __m256i lut = bcast16(Hexdigits);
+
+    __m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), m);
+
+    *hi = _mm256_shuffle_epi8(lut, h);
+    *lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, m));
+}
+#elif defined(USE_SSE2)
+/*
+ * w holds four groups of a space, two digits and a zero byte; returns
+ * them as 12 bytes followed by 4 zeros.  The groups are first joined in
+ * pairs within each 64 bit half, then the halves are joined.
+ */
+static __m128i triples(__m128i w)
+{
+    w = _mm_or_si128(_mm_and_si128(w, _mm_set_epi32(0, -1, 0, -1)),
+            _mm_and_si128(_mm_srli_epi64(w, 8),
+            _mm_set_epi32(-1, (int)0xff000000, -1, (int)0xff000000)));
+    return _mm_or_si128(_mm_and_si128(w, _mm_set_epi32(0, 0, 0xffff, -1)),
+            _mm_and_si128(_mm_srli_si128(w, 2),
+            _mm_set_epi32(-1, -1, (int)0xffff0000, 0)));
+}
+#endif
+
+/* two lower case hex digits per byte, no separators */
+static char *hexpacked(char *d, unsigned char *p, int leng)
+{
+#if defined(USE_SSE2) || defined(USE_SSSE3)
+    __m128i hi, lo;
+
+    for (; leng >= 16; leng -= 16, p += 16, d += 32) {
+        hexdigits16(p, &hi, &lo);
+        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(d+16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    while (leng-- > 0) {
+        *d++ = Hexdigits[*p >> 4];
+        *d++ = Hexdigits[*p++ & 0xf];
+    }
+    return d;
+}
+
+/*
+ * Each byte as a space followed by two lower case hex digits (3*leng
+ * characters).  Returns the end of the result.
+ */
+char *hexexpand(char *d, unsigned char *p, int leng)
+{
+#if defined(USE_SSSE3)
+    /* for each output byte: the input byte whose digit goes there */
+    static const signed char sel[6][16] = {
+        { -1, 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1,-1 },
+        { -1,-1, 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1 },
+        {  5,-1,-1, 6,-1,-1, 7,-1,-1, 8,-1,-1, 9,-1,-1,10 },
+        { -1, 5,-1,-1, 6,-1,-1, 7,-1,-1, 8,-1,-1, 9,-1,-1 },
+        { -1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1 },
+        { 10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15 },
+    };
+    static const char spaces[3][16] = {
+        { ' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ' },
+        { 0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0 },
+        { 0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0 },
+    };
+    __m128i hi, lo, h, l, s;
+    int i;
+#if defined(USE_AVX2)
+    __m256i hi2, lo2, r[3];
+
+    for (; leng >= 32; leng -= 32, p += 32, d += 96) {
+        hexdigits32(p, &hi2, &lo2);
+        for (i = 0; i < 3; i++)
+            r[i] = _mm256_or_si256(bcast16(spaces[i]), _mm256_or_si256(
+                    _mm256_shuffle_epi8(hi2, bcast16(sel[2*i])),
+                    _mm256_shuffle_epi8(lo2, bcast16(sel[2*i+1]))));
+        /* the first 48 characters are in the low lanes */
+        _mm256_storeu_si256((__m256i *)d,
+                _mm256_permute2x128_si256(r[0], r[1], 0x20));
+        _mm256_storeu_si256((__m256i *)(d + 32),
+                _mm256_permute2x128_si256(r[2], r[0], 0x30));
+        _mm256_storeu_si256((__m256i *)(d + 64),
+                _mm256_permute2x128_si256(r[1], r[2], 0x31));
+    }
+#endif
+
+    for (; leng >= 16; leng -= 16, p += 16, d += 48) {
+        hexdigits16(p, &hi, &lo);
+        for (i = 0; i < 3; i++) {
+            h = _mm_loadu_si128((const __m128i *)sel[2*i]);
+            l = _mm_loadu_si128((const __m128i *)sel[2*i+1]);
+            s = _mm_loadu_si128((const __m128i *)spaces[i]);
+            _mm_storeu_si128((__m128i *)(d + 16*i), _mm_or_si128(s,
+                    _mm_or_si128(_mm_shuffle_epi8(hi, h),
+                    _mm_shuffle_epi8(lo, l))));
+        }
+    }
+#elif defined(USE_SSE2)
+    __m128i sp = _mm_set1_epi8(' '), zero = _mm_setzero_si128();
+    __m128i hi, lo, a, b, w[4];
+
+    for (; leng >= 16; leng -= 16, p += 16, d += 48) {
+        hexdigits16(p, &hi, &lo);
+        /* a space, the two digits and a zero for each byte */
+        a = _mm_unpacklo_epi8(sp, hi);
+        b = _mm_unpacklo_epi8(lo, zero);
+        w[0] = triples(_mm_unpacklo_epi16(a, b));
+        w[1] = triples(_mm_unpackhi_epi16(a, b));
+        a = _mm_unpackhi_epi8(sp, hi);
+        b = _mm_unpackhi_epi8(lo, zero);
+        w[2] = triples(_mm_unpacklo_epi16(a, b));
+        w[3] = triples(_mm_unpackhi_epi16(a, b));
+        _mm_storeu_si128((__m128i *)d,
+                _mm_or_si128(w[0], _mm_slli_si128(w[1], 12)));
+        _mm_storeu_si128((__m128i *)(d + 16), _mm_or_si128(
+                _mm_srli_si128(w[1], 4), _mm_slli_si128(w[2], 8)));
+        _mm_storeu_si128((__m128i *)(d + 32), _mm_or_si128(
+                _mm_srli_si128(w[2], 8), _mm_slli_si128(w[3], 4)));
+    }
+#endif
+    while (leng-- > 0) {
+        *d++ = ' ';
+        *d++ = Hexdigits[*p >> 4];
+        *d++ = Hexdigits[*p++ & 0xf];
+    }
+    return d;
+}
+
+/* two lower case hex digits per byte, no separators */
+void outhex(unsigned char *p, int leng)
+{
+    int k;
+
+    while (leng > 0) {
+        outroom(2);
+        k = (Outbuf + OUTBUFSIZ - Outp) / 2;
+        if (k > leng)
+            k = leng;
+        Outp = hexpacked(Outp, p, k);
+        p += k;
+        leng -= k;
+    }
+}
+
+/*
+ * The number of bytes at the start of p that prtext() writes unchanged:
+ * anything from a space up, except " and \.
+ */
+int plainrun(unsigned char *p, int leng)
+{
+    int n = 0;
+#if defined(USE_AVX2)
+    __m256i sp = _mm256_set1_epi8(' ');
+    __m256i qu = _mm256_set1_epi8('"');
+    __m256i bs = _mm256_set1_epi8('\\');
+    __m256i v, ok, bad;
+    unsigned long m;
+
+    for (; n + 32 <= leng; n += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + n));
+        ok = _mm256_cmpeq_epi8(_mm256_max_epu8(v, sp), v);
+        bad = _mm256_or_si256(_mm256_cmpeq_epi8(v, qu),
+                _mm256_cmpeq_epi8(v, bs));
+        m = (unsigned)_mm256_movemask_epi8(_mm256_andnot_si256(bad, ok));
+        if (m != 0xffffffffUL)
+            return n + firstbit(~m & 0xffffffffUL);
+    }
+#elif defined(USE_SSE2) || defined(USE_SSSE3)
+    __m128i sp = _mm_set1_epi8(' ');
+    __m128i qu = _mm_set1_epi8('"');
+    __m128i bs = _mm_set1_epi8('\\');
+    __m128i v, ok, bad;
+    unsigned long m;
+
+    for (; n + 16 <= leng; n += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + n));
+        ok = _mm_cmpeq_epi8(_mm_max_epu8(v, sp), v);
+        bad = _mm_or_si128(_mm_cmpeq_epi8(v, qu), _mm_cmpeq_epi8(v, bs));
+        m = _mm_movemask_epi8(_mm_andnot_si128(bad, ok));
+        if (m != 0xffff)
+            return n + firstbit(~m & 0xffff);
+    }
+#endif
+    while (n < leng && p[n] >= ' ' && p[n] != '"' && p[n] != '\\')
+        n++;
+    return n;
+}
@@ -0,0 +1,518 @@
+/*
+ * mf2tstat
+ *
+ * Summary of a MIDI file for mf2t (-S): the number of events of each
+ * type and per channel, the note range, the programs used, the tempo
+ * range, the duration and the largest number of notes sounding at the
+ * same time.  Nothing is written per event; the report is written when
+ * the whole file has been read, as text or (with -j) as one JSON object.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mf2t.h"
+
+/* the event types, in the order of the report */
+#define S_ON		0
+#define S_OFF		1
+#define S_POPR		2
+#define S_PAR		3
+#define S_PB		4
+#define S_PRCH		5
+#define S_CHPR		6
+#define S_SYSEX		7
+#define S_ARB		8
+#define S_SEQNR		9
+#define S_META		10
+#define S_SEQSPEC	11
+#define S_TRKEND	12
+#define S_KEYSIG	13
+#define S_TEMPO		14
+#define S_TIMESIG	15
+#define S_SMPTE		16
+#define S_NTYPES	17
+
+static char *Typename[S_NTYPES] = {
+    "On", "Off", "PoPr", "Par", "Pb", "PrCh", "ChPr", "SysEx", "Arb",
+    "SeqNr", "Meta", "SeqSpec", "TrkEnd", "KeySig", "Tempo", "TimeSig",
+    "SMPTE"
+};
+
+static int Json;
+static int Format, Ntrks, Division;
+static int Tracks;
+static long Count[S_NTYPES];
+static long Events;
+static long Chanevents[16];
+static long Channotes[16];
+static unsigned char Progused[16][128];
+static int Lownote = 128, Highnote = -1;
+static long Lasttime;
+
+/* tempo changes of all tracks and note starts and ends, sorted at the end */
+struct tchange {
+    long time;
+    long tempo;
+    long seq;		/* input order, to keep qsort stable */
+};
+
+static struct tchange *Tempos;
+static long Ntempos, Temposize;
+
+struct nchange {
+    long time;
+    int delta;		/* +1 for a note start, -1 for an end */
+};
+
+static struct nchange *Notes;
+static long Nnotes, Notesize;
+
+/* notes sounding in the current track */
+static unsigned char Sounding[16][128];
+
+static void *grow(void *p, long *size, long n, int elsize)
+{
+    if (n < *size)
+        return p;
+    *size = *size ? 2 * *size : 1024;
+    p = realloc(p, *size * elsize);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void count(int type)
+{
+    Count[type]++;
+    Events++;
+    if (Mf_currtime > Lasttime)
+        Lasttime = Mf_currtime;
+}
+
+static void chcount(int type, int chan)
+{
+    count(type);
+    Chanevents[chan]++;
+}
+
+static void notechange(int delta)
+{
+    Notes = grow(Notes, &Notesize, Nnotes, sizeof(struct nchange));
+    Notes[Nnotes].time = Mf_currtime;
+    Notes[Nnotes].delta = delta;
+    Nnotes++;
+}
+
+static void noteoff(int chan, int pitch)
+{
+    if (Sounding[chan][pitch] > 0) {
+        Sounding[chan][pitch]--;
+        notechange(-1);
+    }
+}
+
+static void sheader(int format, int ntrks, int division)
+{
+    Format = format;
+    Ntrks = ntrks;
+    Division = division;
+    setheader(format, ntrks, division);
+}
+
+static void strstart(void)
+{
+    TrkNr ++;
+    Tracks++;
+    memset(Sounding, 0, sizeof(Sounding));
+}
+
+/* notes without an end stop at the end of their track */
+static void strend(void)
+{
+    int chan, pitch;
+
+    for (chan = 0; chan < 16; chan++)
+        for (pitch = 0; pitch < 128; pitch++)
+            if (Sounding[chan][pitch] > 0)
+                notechange(-Sounding[chan][pitch]);
+    --TrksToDo;
+}
+
+static void snon(int chan, int pitch, int vol)
+{
+    chcount(S_ON, chan);
+    if (vol == 0) {
+        noteoff(chan, pitch);
+        return;
+    }
+    Channotes[chan]++;
+    if (pitch < Lownote)
+        Lownote = pitch;
+    if (pitch > Highnote)
+        Highnote = pitch;
+    if (Sounding[chan][pitch] < 255) {
+        Sounding[chan][pitch]++;
+        notechange(1);
+    }
+}
+
+static void snoff(int chan, int pitch, int vol)
+{
+    (void)vol;
+    chcount(S_OFF, chan);
+    noteoff(chan, pitch);
+}
+
+static void spressure(int chan, int pitch, int press)
+{
+    (void)pitch; (void)press;
+    chcount(S_POPR, chan);
+}
+
+static void sparameter(int chan, int control, int value)
+{
+    (void)control; (void)value;
+    chcount(S_PAR, chan);
+}
+
+static void spitchbend(int chan, int lsb, int msb)
+{
+    (void)lsb; (void)msb;
+    chcount(S_PB, chan);
+}
+
+static void sprogram(int chan, int program)
+{
+    chcount(S_PRCH, chan);
+    Progused[chan][program & 0x7f] = 1;
+}
+
+static void schanpressure(int chan, int press)
+{
+    (void)press;
+    chcount(S_CHPR, chan);
+}
+
+static void ssysex(int leng, char *mess)
+{
+    (void)leng; (void)mess;
+    count(S_SYSEX);
+}
+
+static void sarbitrary(int leng, char *mess)
+{
+    (void)leng; (void)mess;
+    count(S_ARB);
+}
+
+static void smeta(int type, int leng, char *mess)
+{
+    (void)type; (void)leng; (void)mess;
+    count(S_META);
+}
+
+static void sseqnum(int num)
+{
+    (void)num;
+    count(S_SEQNR);
+}
+
+static void ssqspecific(int leng, char *mess)
+{
+    (void)leng; (void)mess;
+    count(S_SEQSPEC);
+}
+
+static void seot(void)
+{
+    count(S_TRKEND);
+}
+
+static void skeysig(int sf, int mi)
+{
+    (void)sf; (void)mi;
+    count(S_KEYSIG);
+}
+
+static void stempo(long tempo)
+{
+    count(S_TEMPO);
+    Tempos = grow(Tempos, &Temposize, Ntempos, sizeof(struct tchange));
+    Tempos[Ntempos].time = Mf_currtime;
+    Tempos[Ntempos].tempo = tempo;
+    Tempos[Ntempos].seq = Ntempos;
+    Ntempos++;
+}
+
+static void stimesig(int nn, int dd, int cc, int bb)
+{
+    (void)nn; (void)dd; (void)cc; (void)bb;
+    count(S_TIMESIG);
+}
+
+static void ssmpte(int hr, int mn, int se, int fr, int ff)
+{
+    (void)hr; (void)mn; (void)se; (void)fr; (void)ff;
+    count(S_SMPTE);
+}
+
+/* by time, and for equal times ends before starts */
+static int cmpnotes(const void *a, const void *b)
+{
+    const struct nchange *x = a, *y = b;
+
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return x->delta - y->delta;
+}
+
+static int cmptempos(const void *a, const void *b)
+{
+    const struct tchange *x = a, *y = b;
+
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static long polyphony(void)
+{
+    long i, n = 0, peak = 0;
+
+    qsort(Notes, Nnotes, sizeof(struct nchange), cmpnotes);
+    for (i = 0; i < Nnotes; i++) {
+        n += Notes[i].delta;
+        if (n > peak)
+            peak = n;
+    }
+    return peak;
+}
+
+/* the duration in microseconds, with the tempo map of all tracks */
+static long long duration(void)
+{
+    long long usec = 0;
+    long time = 0, tempo = 500000;
+    long i;
+
+    if (Division & 0x8000)
+        return (long long)Lasttime * 1000000 /
+                ((-(signed char)(Division>>8)) * (Division&0xff));
+    qsort(Tempos, Ntempos, sizeof(struct tchange), cmptempos);
+    for (i = 0; i < Ntempos && Tempos[i].time < Lasttime; i++) {
+        usec += (long long)(Tempos[i].time - time) * tempo;
+        time = Tempos[i].time;
+        tempo = Tempos[i].tempo;
+    }
+    usec += (long long)(Lasttime - time) * tempo;
+    return usec / Division;
+}
+
+static void outsec(long long usec)
+{
+    char buf[8];
+
+    outdec((long)(usec / 1000000));
+    sprintf(buf, ".%03d", (int)(usec % 1000000 / 1000));
+    outs(buf);
+}
+
+static void textreport(long peak, long long usec, long lo, long hi)
+{
+    int i, ch, p, first;
+
+    outs("MFile ");
+    outdec(Format);
+    outc(' ');
+    outdec(Ntrks);
+    outc(' ');
+    if (Division & 0x8000) { /* SMPTE */
+        outdec(-((-(Division>>8))&0xff));
+        outc(' ');
+        outdec(Division&0xff);
+    } else
+        outdec(Division);
+    outs("\nTracks ");
+    outdec(Tracks);
+    outs("\nEvents ");
+    outdec(Events);
+    outs("\nDuration ");
+    outdec(Lasttime);
+    if (usec >= 0) {
+        outc(' ');
+        outsec(usec);
+        outc('s');
+    }
+    if (Highnote >= 0) {
+        outs("\nNotes ");
+        outdec(Lownote);
+        outc(' ');
+        outdec(Highnote);
+    }
+    outs("\nPolyphony ");
+    outdec(peak);
+    if (Ntempos > 0) {
+        outs("\nTempo ");
+        outdec(lo);
+        outc(' ');
+        outdec(hi);
+        outc(' ');
+        outdec(Ntempos);
+    }
+    outc('\n');
+    for (i = 0; i < S_NTYPES; i++)
+        if (Count[i]) {
+            outs("Count ");
+            outs(Typename[i]);
+            outc(' ');
+            outdec(Count[i]);
+            outc('\n');
+        }
+    for (ch = 0; ch < 16; ch++) {
+        if (Chanevents[ch] == 0)
+            continue;
+        outs("Chan ch=");
+        outdec(ch+1);
+        outs(" events=");
+        outdec(Chanevents[ch]);
+        outs(" notes=");
+        outdec(Channotes[ch]);
+        outs(" progs=");
+        first = 1;
+        for (p = 0; p < 128; p++)
+            if (Progused[ch][p]) {
+                if (!first)
+                    outc(',');
+                outdec(p);
+                first = 0;
+            }
+        if (first)
+            outc('-');
+        outc('\n');
+    }
+}
+
+static void jsint(char *name, long val)
+{
+    outs(",\"");
+    outs(name);
+    outs("\":");
+    outdec(val);
+}
+
+static void jsonreport(long peak, long long usec, long lo, long hi)
+{
+    int i, ch, p, first;
+
+    outs("{\"format\":");
+    outdec(Format);
+    jsint("ntrks", Ntrks);
+    if (Division & 0x8000) { /* SMPTE */
+        jsint("division", -((-(Division>>8))&0xff));
+        jsint("resolution", Division&0xff);
+    } else
+        jsint("division", Division);
+    jsint("tracks", Tracks);
+    jsint("events", Events);
+    jsint("ticks", Lasttime);
+    if (usec >= 0) {
+        outs(",\"seconds\":");
+        outsec(usec);
+    }
+    if (Highnote >= 0) {
+        jsint("lownote", Lownote);
+        jsint("highnote", Highnote);
+    }
+    jsint("polyphony", peak);
+    if (Ntempos > 0) {
+        jsint("tempomin", lo);
+        jsint("tempomax", hi);
+    }
+    jsint("tempochanges", Ntempos);
+    outs(",\"counts\":{");
+    first = 1;
+    for (i = 0; i < S_NTYPES; i++)
+        if (Count[i]) {
+            outs(first ? "\"" : ",\"");
+            outs(Typename[i]);
+            outs("\":");
+            outdec(Count[i]);
+            first = 0;
+        }
+    outs("},\"channels\":[");
+    first = 1;
+    for (ch = 0; ch < 16; ch++) {
+        if (Chanevents[ch] == 0)
+            continue;
+        outs(first ? "{\"ch\":" : ",{\"ch\":");
+        outdec(ch+1);
+        jsint("events", Chanevents[ch]);
+        jsint("notes", Channotes[ch]);
+        outs(",\"programs\":[");
+        first = 1;
+        for (p = 0; p < 128; p++)
+            if (Progused[ch][p]) {
+                if (!first)
+                    outc(',');
+                outdec(p);
+                first = 0;
+            }
+        outs("]}");
+        first = 0;
+    }
+    outs("]}\n");
+}
+
+void statfinish(void)
+{
+    long peak = polyphony();
+    long long usec = -1;
+    long lo = 0, hi = 0;
+    long i;
+
+    /*
+     * the tracks of a format 2 file each have their own tempo map, and
+     * without clicks per quarter note or frames there are no seconds
+     */
+    if (Format != 2 && (Division & 0x8000 ? Division & 0xff : Division))
+        usec = duration();
+    for (i = 0; i < Ntempos; i++) {
+        if (i == 0 || Tempos[i].tempo < lo)
+            lo = Tempos[i].tempo;
+        if (i == 0 || Tempos[i].tempo > hi)
+            hi = Tempos[i].tempo;
+    }
+    if (Json)
+        jsonreport(peak, usec, lo, hi);
+    else
+        textreport(peak, usec, lo, hi);
+}
+
+void initstat(int json)
+{
+    Json = json;
+    Mf_header =  sheader;
+    Mf_starttrack =  strstart;
+    Mf_endtrack =  strend;
+    Mf_on =  snon;
+    Mf_off =  snoff;
+    Mf_pressure =  spressure;
+    Mf_parameter =  sparameter;
+    Mf_pitchbend =  spitchbend;
+    Mf_program =  sprogram;
+    Mf_chanpressure =  schanpressure;
+    Mf_sysex =  ssysex;
+    Mf_metamisc =  smeta;
+    Mf_seqnum =  sseqnum;
+    Mf_eot =  seot;
+    Mf_timesig =  stimesig;
+    Mf_smpte =  ssmpte;
+    Mf_tempo =  stempo;
+    Mf_keysig =  skeysig;
+    Mf_sqspecific =  ssqspecific;
+    Mf_text =  smeta;
+    Mf_arbitrary =  sarbitrary;
+}
@@ -0,0 +1,221 @@
+/*
+ * mf2ttok
+ *
+ * Token output for mf2t (-T).  The events are written in the order of
+ * the text format, but as fixed-width binary records with the payload
+ * after them, so that other programs (and t2mf, which reads it back) can
+ * walk through a file without lexing or formatting numbers.
+ *
+ * All numbers are little-endian.  The file starts with a 16 byte header:
+ *
+ *      0   8   magic "MF2TTOK1"
+ *      8   2   format
+ *     10   2   number of tracks
+ *     12   2   division, as in the MThd chunk
+ *     14   2   zero
+ *
+ * followed by one 16 byte record for every line of the text:
+ *
+ *      0   8   tick, the absolute time
+ *      8   1   token
+ *      9   1   data1
+ *     10   1   data2
+ *     11   1   zero
+ *     12   4   n, the size of the payload
+ *
+ * and the n bytes of the payload, padded with zeros to a multiple of 8
+ * bytes, so every record starts at a multiple of 8.  The token is 01
+ * for MTrk and 02 for TrkEnd, and otherwise the status byte as in
+ * mf2tcol.c: 80–EF for channel messages (with data1 and data2 as in the
+ * file), F0 for sysex, F7 for arbitrary data and FF for meta events,
+ * which have the meta type in data1.  The payload is the same as in the
+ * columnar output.
+ */
+
+#include <stdio.h>
+#include "mf2t.h"
+
+#define TOKRECSIZE	16
+
+static void outle(unsigned long v, int n)
+{
+    outroom(n);
+    while (n-- > 0) {
+        *Outp++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static void tokrec(int token, int c1, int c2, char *mess, int leng)
+{
+    outroom(TOKRECSIZE);
+    outle(Mf_currtime, 8);
+    outle(token, 1);
+    outle(c1 & 0xff, 1);
+    outle(c2 & 0xff, 1);
+    outle(0, 1);
+    outle(leng, 4);
+    if (leng > 0) {
+        outmem(mess, leng);
+        outle(0, (8 - leng % 8) % 8);
+    }
+}
+
+static void tokheader(int format, int ntrks, int division)
+{
+    setheader(format, ntrks, division);
+    outmem("MF2TTOK1", 8);
+    outle(format, 2);
+    outle(ntrks, 2);
+    outle(division, 2);
+    outle(0, 2);
+}
+
+static void toktrstart(void)
+{
+    TrkNr ++;
+    tokrec(0x01, 0, 0, NULL, 0);
+}
+
+static void toktrend(void)
+{
+    tokrec(0x02, 0, 0, NULL, 0);
+    --TrksToDo;
+}
+
+static void toknon(int chan, int pitch, int vol)
+{
+    tokrec(note_on | chan, pitch, vol, NULL, 0);
+}
+
+static void toknoff(int chan, int pitch, int vol)
+{
+    tokrec(note_off | chan, pitch, vol, NULL, 0);
+}
+
+static void tokpressure(int chan, int pitch, int press)
+{
+    tokrec(poly_aftertouch | chan, pitch, press, NULL, 0);
+}
+
+static void tokparameter(int chan, int control, int value)
+{
+    tokrec(control_change | chan, control, value, NULL, 0);
+}
+
+static void tokpitchbend(int chan, int lsb, int msb)
+{
+    tokrec(pitch_wheel | chan, lsb, msb, NULL, 0);
+}
+
+static void tokprogram(int chan, int program)
+{
+    tokrec(program_chng | chan, program, 0, NULL, 0);
+}
+
+static void tokchanpressure(int chan, int press)
+{
+    tokrec(channel_aftertouch | chan, press, 0, NULL, 0);
+}
+
+static void toksysex(int leng, char *mess)
+{
+    tokrec(system_exclusive, 0, 0, mess, leng);
+}
+
+static void tokarbitrary(int leng, char *mess)
+{
+    tokrec(0xf7, 0, 0, mess, leng);
+}
+
+static void tokmeta(int type, int leng, char *mess)
+{
+    tokrec(meta_event, type, 0, mess, leng);
+}
+
+static void tokmspecial(int leng, char *mess)
+{
+    tokmeta(sequencer_specific, leng, mess);
+}
+
+/* the data bytes of the meta events that the library decodes */
+static void tokmseq(int num)
+{
+    char m[2];
+
+    m[0] = num >> 8;
+    m[1] = num;
+    tokmeta(sequence_number, 2, m);
+}
+
+static void tokmeot(void)
+{
+    tokmeta(end_of_track, 0, NULL);
+}
+
+static void tokkeysig(int sf, int mi)
+{
+    char m[2];
+
+    m[0] = sf;
+    m[1] = mi;
+    tokmeta(key_signature, 2, m);
+}
+
+static void toktempo(long tempo)
+{
+    char m[3];
+
+    m[0] = tempo >> 16;
+    m[1] = tempo >> 8;
+    m[2] = tempo;
+    tokmeta(set_tempo, 3, m);
+}
+
+static void toktimesig(int nn, int dd, int cc, int bb)
+{
+    char m[4];
+
+    m[0] = nn;
+    m[1] = dd;
+    m[2] = cc;
+    m[3] = bb;
+    tokmeta(time_signature, 4, m);
+}
+
+static void toksmpte(int hr, int mn, int se, int fr, int ff)
+{
+    char m[5];
+
+    m[0] = hr;
+    m[1] = mn;
+    m[2] = se;
+    m[3] = fr;
+    m[4] = ff;
+    tokmeta(smpte_offset, 5, m);
+}
+
+void inittok(void)
+{
+    Mf_header =  tokheader;
+    Mf_starttrack =  toktrstart;
+    Mf_endtrack =  toktrend;
+    Mf_on =  toknon;
+    Mf_off =  toknoff;
+    Mf_pressure =  tokpressure;
+    Mf_parameter =  tokparameter;
+    Mf_pitchbend =  tokpitchbend;
+    Mf_program =  tokprogram;
+    Mf_chanpressure =  tokchanpressure;
+    Mf_sysex =  toksysex;
+    Mf_metamisc =  tokmeta;
+    Mf_seqnum =  tokmseq;
+    Mf_eot =  tokmeot;
+    Mf_timesig =  toktimesig;
+    Mf_smpte =  toksmpte;
+    Mf_tempo =  toktempo;
+    Mf_keysig =  tokkeysig;
+    Mf_sqspecific =  tokmspecial;
+    Mf_text =  tokmeta;
+    Mf_arbitrary =  tokarbitrary;
+}
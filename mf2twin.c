@@ -0,0 +1,602 @@
+/*
+ * mf2twin
+ *
+ * Time window selection for mf2t (-s and -e).  The callbacks of the
+ * selected output mode are wrapped: events before the start of the
+ * window only update the "chase" state of the track (tempo, time and key
+ * signature, and program, controllers and pitch bend per channel), which
+ * is written at the start of the window before the first event inside
+ * it.  At the end of the window notes that are still sounding are
+ * switched off, the track is ended and the rest of it is skipped
+ * without decoding.
+ *
+ * A window limit is given in ticks (1920), as bar:beat:click (12:0:0)
+ * or in seconds (30s, 12.5s).  Bars and seconds are converted with the
+ * time signatures and tempo changes seen so far, which in a format 1
+ * file are all in the first track.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mf2t.h"
+#include "mtime.h"
+
+#define W_TICKS		0
+#define W_BARS		1
+#define W_SECS		2
+
+struct wtime {
+    int kind;
+    long tick;			/* W_TICKS */
+    long bar, beat, click;	/* W_BARS */
+    long long usec;		/* W_SECS */
+};
+
+static struct wtime Wfrom, Wto;
+static int Haveto = 0;
+static long Wstart, Wend;	/* the window in ticks */
+
+static int Format, Division;
+
+/* time signatures and tempo changes, in time order */
+static struct mtime *Sigmap;
+static int Nsig, Sigmapsize;
+
+struct tempochange {
+    long time;
+    long tempo;
+};
+
+static struct tempochange *Tempomap;
+static int Ntempo, Tempomapsize;
+
+/* chase state of the current track; -1 if not seen */
+static long Ctempo;
+static int Ckeysig[2];
+static int Cprog[16];
+static int Cbend[16];
+static signed char Cctrl[16][128];
+
+/* the time signatures of the current track before the window */
+struct sigchange {
+    long time;
+    int sig[4];
+};
+
+static struct sigchange *Csigs;
+static int Ncsigs, Csigsize;
+
+static unsigned char Sounding[16][128];
+static int Chased, Closed;
+
+/* the callbacks of the output mode */
+static void (*Oheader)(), (*Otrstart)(), (*Otrend)();
+static void (*Oon)(), (*Ooff)(), (*Opressure)(), (*Oparameter)();
+static void (*Opitchbend)(), (*Oprogram)(), (*Ochanpressure)();
+static void (*Osysex)(), (*Ometamisc)(), (*Oseqnum)(), (*Oeot)();
+static void (*Otimesig)(), (*Osmpte)(), (*Otempo)(), (*Okeysig)();
+static void (*Osqspecific)(), (*Otext)(), (*Oarbitrary)();
+
+static void *grow(void *p, int *size, int n, int elsize)
+{
+    if (n < *size)
+        return p;
+    *size = *size ? 2 * *size : 64;
+    p = realloc(p, *size * elsize);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * Parse a window limit: ticks, bar:beat:click or seconds with an
+ * optional fraction followed by `s'.  Returns 0 on a syntax error.
+ */
+static int parsetime(char *s, struct wtime *w)
+{
+    char *p;
+    long frac = 0, scale = 1000000;
+
+    w->tick = strtol(s, &p, 10);
+    if (p == s || w->tick < 0)
+        return 0;
+    if (*p == '\0') {
+        w->kind = W_TICKS;
+        return 1;
+    }
+    if (*p == ':') {
+        w->kind = W_BARS;
+        w->bar = w->tick;
+        w->beat = strtol(p+1, &p, 10);
+        if (*p != ':')
+            return 0;
+        w->click = strtol(p+1, &p, 10);
+        return *p == '\0';
+    }
+    w->kind = W_SECS;
+    if (*p == '.')
+        for (p++; *p >= '0' && *p <= '9'; p++)
+            if (scale > 1) {
+                scale /= 10;
+                frac += (*p - '0') * scale;
+            }
+    if (strcmp(p, "s") != 0)
+        return 0;
+    w->usec = (long long)w->tick * 1000000 + frac;
+    return 1;
+}
+
+/* the first tick at or after the time in microseconds */
+static long sec2tick(long long usec)
+{
+    long long acc = 0, target, seg;
+    int i;
+
+    if (Division & 0x8000) { /* SMPTE: frames per second times ticks */
+        target = usec * (-(signed char)(Division>>8)) * (Division&0xff);
+        return (long)((target + 999999) / 1000000);
+    }
+    /* in units of a microsecond divided by the division */
+    target = usec * Division;
+    for (i = 0; i + 1 < Ntempo; i++) {
+        seg = (long long)(Tempomap[i+1].time - Tempomap[i].time) *
+                Tempomap[i].tempo;
+        if (acc + seg >= target)
+            break;
+        acc += seg;
+    }
+    return Tempomap[i].time +
+            (long)((target - acc + Tempomap[i].tempo - 1) / Tempomap[i].tempo);
+}
+
+static long bar2tick(struct wtime *w)
+{
+    int i = Nsig - 1;
+
+    while (i > 0 && Sigmap[i].m0 > w->bar)
+        i--;
+    return mt_ticks(&Sigmap[i], w->bar, w->beat, w->click);
+}
+
+static long wtick(struct wtime *w)
+{
+    switch (w->kind) {
+        case W_BARS:
+            return bar2tick(w);
+        case W_SECS:
+            return sec2tick(w->usec);
+        default:
+            return w->tick;
+    }
+}
+
+/* called whenever the maps change */
+static void resolve(void)
+{
+    Wstart = wtick(&Wfrom);
+    if (Haveto)
+        Wend = wtick(&Wto);
+}
+
+static void resetmaps(void)
+{
+    Nsig = 0;
+    Sigmap = grow(Sigmap, &Sigmapsize, Nsig, sizeof(struct mtime));
+    mt_init(&Sigmap[Nsig++], Division);
+    Ntempo = 0;
+    Tempomap = grow(Tempomap, &Tempomapsize, Ntempo,
+            sizeof(struct tempochange));
+    Tempomap[0].time = 0;
+    Tempomap[0].tempo = 500000;
+    Ntempo++;
+}
+
+/*
+ * The denominator of a time signature, from its power of two; one
+ * without bars or beats (nn 0, or a denominator too large for the
+ * division) counts as 4/4 in the bar arithmetic.
+ */
+static int sigdenom(int *nn, int dd)
+{
+    int denom = dd < 31 ? 1 << dd : 0;
+
+    if (*nn <= 0 || denom == 0 || 4 * Division / denom == 0) {
+        *nn = 4;
+        return 4;
+    }
+    return denom;
+}
+
+/*
+ * Changes that are not later than the last one in the map come from
+ * another track of a format 1 file and are ignored for the conversion.
+ */
+static void addtimesig(int nn, int dd)
+{
+    int denom = sigdenom(&nn, dd);
+
+    if (Mf_currtime < Sigmap[Nsig-1].t0)
+        return;
+    Sigmap = grow(Sigmap, &Sigmapsize, Nsig, sizeof(struct mtime));
+    Sigmap[Nsig] = Sigmap[Nsig-1];
+    mt_timesig(&Sigmap[Nsig], Mf_currtime, nn, denom);
+    if (Mf_currtime == Sigmap[Nsig-1].t0)
+        Sigmap[Nsig-1] = Sigmap[Nsig];
+    else
+        Nsig++;
+    resolve();
+}
+
+static void addtempo(long tempo)
+{
+    if (Mf_currtime < Tempomap[Ntempo-1].time)
+        return;
+    if (Mf_currtime > Tempomap[Ntempo-1].time) {
+        Tempomap = grow(Tempomap, &Tempomapsize, Ntempo,
+                sizeof(struct tempochange));
+        Tempomap[Ntempo++].time = Mf_currtime;
+    }
+    Tempomap[Ntempo-1].tempo = tempo;
+    resolve();
+}
+
+/*
+ * Bank select comes before the program change, the (N)RPN selection
+ * before the other controllers and pitch bend last.
+ */
+static void chase(void)
+{
+    static int first[] = { 0, 32, -1, 99, 98, 101, 100 };
+    int nfirst = sizeof(first)/sizeof(int);
+    long now = Mf_currtime;
+    int ch, i, c;
+
+    Chased = 1;
+    /*
+     * The output mode takes the time signature as starting a bar at
+     * the window start, but the bars still run from the real one.  In
+     * bar:beat:click times a text that is read back starts the bars
+     * again at each time signature, so then all of them are written at
+     * their own times, from the state at the start of the track on.
+     */
+    if (Ncsigs > 0 && Otimesig) {
+        if (bartimes()) {
+            restoretimes();
+            for (i = 0; i < Ncsigs; i++) {
+                Mf_currtime = Csigs[i].time;
+                (*Otimesig)(Csigs[i].sig[0], Csigs[i].sig[1],
+                        Csigs[i].sig[2], Csigs[i].sig[3]);
+            }
+        } else {
+            Mf_currtime = Wstart;
+            i = Ncsigs - 1;
+            savetimes();
+            (*Otimesig)(Csigs[i].sig[0], Csigs[i].sig[1],
+                    Csigs[i].sig[2], Csigs[i].sig[3]);
+            restoretimes();
+        }
+    }
+    Mf_currtime = Wstart;
+    if (Ckeysig[0] >= 0 && Okeysig)
+        (*Okeysig)(Ckeysig[0], Ckeysig[1]);
+    if (Ctempo >= 0 && Otempo)
+        (*Otempo)(Ctempo);
+    for (ch = 0; ch < 16; ch++) {
+        for (i = 0; i < nfirst; i++) {
+            c = first[i];
+            if (c < 0) {
+                if (Cprog[ch] >= 0 && Oprogram)
+                    (*Oprogram)(ch, Cprog[ch]);
+            } else if (Cctrl[ch][c] >= 0 && Oparameter)
+                (*Oparameter)(ch, c, Cctrl[ch][c]);
+        }
+        for (c = 0; c < 128; c++) {
+            for (i = 0; i < nfirst && first[i] != c; i++)
+                ;
+            if (i == nfirst && Cctrl[ch][c] >= 0 && Oparameter)
+                (*Oparameter)(ch, c, Cctrl[ch][c]);
+        }
+        if (Cbend[ch] >= 0 && Opitchbend)
+            (*Opitchbend)(ch, Cbend[ch] & 0x7f, Cbend[ch] >> 7);
+    }
+    Mf_currtime = now;
+}
+
+static void closewindow(void)
+{
+    long now = Mf_currtime;
+    int ch, n;
+
+    if (!Chased)
+        chase();
+    Mf_currtime = Wend;
+    for (ch = 0; ch < 16; ch++)
+        for (n = 0; n < 128; n++)
+            for (; Sounding[ch][n] > 0; Sounding[ch][n]--)
+                if (Ooff)
+                    (*Ooff)(ch, n, 0);
+    if (Oeot)
+        (*Oeot)();
+    Mf_currtime = now;
+    Closed = 1;
+    mf_skiptrack();
+}
+
+/* 1 if the current event is inside the window */
+static int inwindow(void)
+{
+    if (Closed || Mf_currtime < Wstart)
+        return 0;
+    if (Haveto && Mf_currtime >= Wend) {
+        closewindow();
+        return 0;
+    }
+    if (!Chased)
+        chase();
+    return 1;
+}
+
+static int beforewindow(void)
+{
+    return !Closed && Mf_currtime < Wstart;
+}
+
+static void wheader(int format, int ntrks, int division)
+{
+    Format = format;
+    Division = division;
+    resetmaps();
+    resolve();
+    if (Oheader)
+        (*Oheader)(format, ntrks, division);
+}
+
+static void wtrstart(void)
+{
+    if (Format == 2) {
+        resetmaps();
+        resolve();
+    }
+    Ctempo = -1;
+    Ncsigs = 0;
+    savetimes();	/* for the time signatures of the chase */
+    Ckeysig[0] = -1;
+    memset(Cprog, -1, sizeof(Cprog));
+    memset(Cbend, -1, sizeof(Cbend));
+    memset(Cctrl, -1, sizeof(Cctrl));
+    memset(Sounding, 0, sizeof(Sounding));
+    Chased = Closed = 0;
+    if (Otrstart)
+        (*Otrstart)();
+}
+
+static void wtrend(void)
+{
+    if (!Closed && !Chased)
+        chase();
+    if (Otrend)
+        (*Otrend)();
+}
+
+static void won(int chan, int pitch, int vol)
+{
+    if (!inwindow())
+        return;
+    if (vol > 0) {
+        if (Sounding[chan][pitch] < 255)
+            Sounding[chan][pitch]++;
+    } else if (Sounding[chan][pitch] > 0)
+        Sounding[chan][pitch]--;
+    if (Oon)
+        (*Oon)(chan, pitch, vol);
+}
+
+static void woff(int chan, int pitch, int vol)
+{
+    if (!inwindow())
+        return;
+    if (Sounding[chan][pitch] > 0)
+        Sounding[chan][pitch]--;
+    if (Ooff)
+        (*Ooff)(chan, pitch, vol);
+}
+
+static void wpressure(int chan, int pitch, int press)
+{
+    if (inwindow() && Opressure)
+        (*Opressure)(chan, pitch, press);
+}
+
+/* Reset All Controllers leaves bank select, volume and pan alone */
+static void resetctrls(int chan)
+{
+    int c;
+
+    for (c = 1; c < 120; c++)
+        if (c != 7 && c != 10 && c != 32)
+            Cctrl[chan][c] = -1;
+    Cbend[chan] = -1;
+}
+
+static void wparameter(int chan, int control, int value)
+{
+    if (inwindow()) {
+        if (Oparameter)
+            (*Oparameter)(chan, control, value);
+    } else if (beforewindow()) {
+        if (control == 121)
+            resetctrls(chan);
+        else if (control != 120 && control != 123)
+            Cctrl[chan][control] = value;
+    }
+}
+
+static void wpitchbend(int chan, int lsb, int msb)
+{
+    if (inwindow()) {
+        if (Opitchbend)
+            (*Opitchbend)(chan, lsb, msb);
+    } else if (beforewindow())
+        Cbend[chan] = 128*msb+lsb;
+}
+
+static void wprogram(int chan, int program)
+{
+    if (inwindow()) {
+        if (Oprogram)
+            (*Oprogram)(chan, program);
+    } else if (beforewindow())
+        Cprog[chan] = program;
+}
+
+static void wchanpressure(int chan, int press)
+{
+    if (inwindow() && Ochanpressure)
+        (*Ochanpressure)(chan, press);
+}
+
+static void wsysex(int leng, char *mess)
+{
+    if (inwindow() && Osysex)
+        (*Osysex)(leng, mess);
+}
+
+static void wmetamisc(int type, int leng, char *mess)
+{
+    if (inwindow() && Ometamisc)
+        (*Ometamisc)(type, leng, mess);
+}
+
+static void wseqnum(int num)
+{
+    if (inwindow() && Oseqnum)
+        (*Oseqnum)(num);
+}
+
+static void weot(void)
+{
+    if (inwindow() && Oeot)
+        (*Oeot)();
+}
+
+static void wtimesig(int nn, int dd, int cc, int bb)
+{
+    int denom;
+
+    addtimesig(nn, dd);
+    if (inwindow()) {
+        if (Otimesig)
+            (*Otimesig)(nn, dd, cc, bb);
+    } else if (beforewindow()) {
+        Csigs = grow(Csigs, &Csigsize, Ncsigs, sizeof(struct sigchange));
+        Csigs[Ncsigs].time = Mf_currtime;
+        Csigs[Ncsigs].sig[0] = nn & 0xff;
+        Csigs[Ncsigs].sig[1] = dd & 0xff;
+        Csigs[Ncsigs].sig[2] = cc & 0xff;
+        Csigs[Ncsigs].sig[3] = bb & 0xff;
+        Ncsigs++;
+        denom = sigdenom(&nn, dd);
+        settimesig(nn, denom);
+    }
+}
+
+static void wsmpte(int hr, int mn, int se, int fr, int ff)
+{
+    if (inwindow() && Osmpte)
+        (*Osmpte)(hr, mn, se, fr, ff);
+}
+
+static void wtempo(long tempo)
+{
+    addtempo(tempo);
+    if (inwindow()) {
+        if (Otempo)
+            (*Otempo)(tempo);
+    } else if (beforewindow())
+        Ctempo = tempo;
+}
+
+static void wkeysig(int sf, int mi)
+{
+    if (inwindow()) {
+        if (Okeysig)
+            (*Okeysig)(sf, mi);
+    } else if (beforewindow()) {
+        Ckeysig[0] = sf & 0xff;
+        Ckeysig[1] = mi;
+    }
+}
+
+static void wsqspecific(int leng, char *mess)
+{
+    if (inwindow() && Osqspecific)
+        (*Osqspecific)(leng, mess);
+}
+
+static void wtext(int type, int leng, char *mess)
+{
+    if (inwindow() && Otext)
+        (*Otext)(type, leng, mess);
+}
+
+static void warbitrary(int leng, char *mess)
+{
+    if (inwindow() && Oarbitrary)
+        (*Oarbitrary)(leng, mess);
+}
+
+/* seek over the skipped part of a track if the input allows it */
+static void skipinput(long n)
+{
+    if (fseek(stdin, n, SEEK_CUR) != 0)
+        while (n-- > 0)
+            getchar();
+}
+
+/*
+ * Set the window from the -s and -e arguments (either may be NULL).
+ * Returns 0 if one of them cannot be parsed.
+ */
+int setwindow(char *from, char *to)
+{
+    Wfrom.kind = W_TICKS;
+    Wfrom.tick = 0;
+    if (from && !parsetime(from, &Wfrom))
+        return 0;
+    if (to) {
+        if (!parsetime(to, &Wto))
+            return 0;
+        Haveto = 1;
+    }
+    return 1;
+}
+
+/* to be called after the callbacks of the output mode are set */
+void initwindow(void)
+{
+    Oheader = Mf_header;            Mf_header = wheader;
+    Otrstart = Mf_starttrack;       Mf_starttrack = wtrstart;
+    Otrend = Mf_endtrack;           Mf_endtrack = wtrend;
+    Oon = Mf_on;                    Mf_on = won;
+    Ooff = Mf_off;                  Mf_off = woff;
+    Opressure = Mf_pressure;        Mf_pressure = wpressure;
+    Oparameter = Mf_parameter;      Mf_parameter = wparameter;
+    Opitchbend = Mf_pitchbend;      Mf_pitchbend = wpitchbend;
+    Oprogram = Mf_program;          Mf_program = wprogram;
+    Ochanpressure = Mf_chanpressure; Mf_chanpressure = wchanpressure;
+    Osysex = Mf_sysex;              Mf_sysex = wsysex;
+    Ometamisc = Mf_metamisc;        Mf_metamisc = wmetamisc;
+    Oseqnum = Mf_seqnum;            Mf_seqnum = wseqnum;
+    Oeot = Mf_eot;                  Mf_eot = weot;
+    Otimesig = Mf_timesig;          Mf_timesig = wtimesig;
+    Osmpte = Mf_smpte;              Mf_smpte = wsmpte;
+    Otempo = Mf_tempo;              Mf_tempo = wtempo;
+    Okeysig = Mf_keysig;            Mf_keysig = wkeysig;
+    Osqspecific = Mf_sqspecific;    Mf_sqspecific = wsqspecific;
+    Otext = Mf_text;                Mf_text = wtext;
+    Oarbitrary = Mf_arbitrary;      Mf_arbitrary = warbitrary;
+    Mf_skip = skipinput;
+}
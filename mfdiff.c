@@ -0,0 +1,615 @@
+/*
+ * mfdiff
+ *
+ * Compare two MIDI files event by event.
+ *
+ * The tracks of the two files are first paired up: tracks with the same
+ * MTrk bytes are paired without being decoded at all, then the others
+ * are decoded and paired by track name, and what is left over by order.
+ * Within a pair of tracks the events are compared by absolute time, so
+ * an inserted event does not shift everything after it.  Events at the
+ * same time are matched regardless of their order; an event that is
+ * only in one of the files is reported as removed (-) or added (+), and
+ * when only its value differs (e.g. the velocity of a note or the data
+ * of a sysex) as changed (~).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "midifile.h"
+#include "version.h"
+#include "getopt.h"
+
+struct event {
+    long time;
+    char *key;		/* what the event is about, e.g. "On ch=1 n=60" */
+    char *val;		/* its value, e.g. "v=64" */
+    int matched;
+};
+
+struct track {
+    unsigned char *raw;	/* the bytes of the MTrk chunk after the length */
+    long len;
+    int pair;		/* the track in the other file, or -1 */
+    int decode;
+    char *name;
+    struct event *ev;
+    long nev, size;
+};
+
+struct mfile {
+    char *path;
+    unsigned char *data;
+    long size;
+    int format, ntrks, division;
+    struct track *trk;
+    int ntrk;
+    struct mf_arena *arena;	/* the tracks, events and their strings */
+};
+
+static struct mfile A, B;
+
+static int quiet = 0;		/* only set the exit status */
+static int verbose = 0;		/* also list identical tracks */
+static int Differ = 0;
+
+/* the file and track being decoded */
+static struct mfile *Cur;
+static int Curtrk;
+static unsigned char *Inp, *Inend;
+
+static void *xalloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+static char *keep(char *s)
+{
+    return mf_arena_copy(Cur->arena, s, strlen(s) + 1);
+}
+
+static long get32(unsigned char *p)
+{
+    return ((long)p[0] << 24) | ((long)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* read the file and find its MTrk chunks */
+static void load(struct mfile *mf, char *path)
+{
+    FILE *fp;
+    unsigned char *p, *end;
+    long len;
+
+    mf->path = path;
+    mf->arena = mf_arena_new();
+    if ((fp = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "mfdiff: %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+    fseek(fp, 0L, SEEK_END);
+    mf->size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    mf->data = xalloc(NULL, mf->size + 1);
+    if (fread(mf->data, 1, mf->size, fp) != (size_t)mf->size) {
+        fprintf(stderr, "mfdiff: %s: read error\n", path);
+        exit(2);
+    }
+    fclose(fp);
+
+    p = mf->data;
+    end = p + mf->size;
+    if (mf->size < 14 || memcmp(p, "MThd", 4) != 0) {
+        fprintf(stderr, "mfdiff: %s: not a MIDI file\n", path);
+        exit(2);
+    }
+    mf->format = (p[8] << 8) | p[9];
+    mf->ntrks = (p[10] << 8) | p[11];
+    mf->division = (p[12] << 8) | p[13];
+    len = get32(p + 4);
+    if (len < 0 || len > end - p - 8)
+        len = end - p - 8;
+    p += 8 + len;
+    while (p + 8 <= end) {
+        len = get32(p + 4);
+        if (len < 0 || len > end - p - 8)
+            len = end - p - 8;
+        if (memcmp(p, "MTrk", 4) == 0) {
+            mf->trk = mf_arena_realloc(mf->arena, mf->trk,
+                    mf->ntrk * sizeof(struct track),
+                    (mf->ntrk + 1) * sizeof(struct track));
+            memset(&mf->trk[mf->ntrk], 0, sizeof(struct track));
+            mf->trk[mf->ntrk].raw = p + 8;
+            mf->trk[mf->ntrk].len = len;
+            mf->trk[mf->ntrk].pair = -1;
+            mf->ntrk++;
+        }
+        p += 8 + len;
+    }
+}
+
+/*
+ * Decoding: the library reads the file from memory and skips the tracks
+ * that need no decoding.
+ */
+static int memgetc(void)
+{
+    return Inp < Inend ? *Inp++ : EOF;
+}
+
+static void memskip(long n)
+{
+    Inp += n < Inend - Inp ? n : Inend - Inp;
+}
+
+static void error(char *s)
+{
+    fprintf(stderr, "mfdiff: %s: %s\n", Cur->path, s);
+    exit(2);
+}
+
+/* the strings of the event are set by the caller */
+static struct event *newevent(void)
+{
+    struct track *t = &Cur->trk[Curtrk];
+    struct event *e;
+
+    if (t->nev == t->size) {
+        t->ev = mf_arena_realloc(Cur->arena, t->ev,
+                t->size * sizeof(struct event),
+                (t->size ? 2 * t->size : 256) * sizeof(struct event));
+        t->size = t->size ? 2 * t->size : 256;
+    }
+    e = &t->ev[t->nev++];
+    e->time = Mf_currtime;
+    e->matched = 0;
+    return e;
+}
+
+static void addevent(char *key, char *val)
+{
+    struct event *e = newevent();
+
+    e->key = keep(key);
+    e->val = keep(val);
+}
+
+static char *hex(unsigned char *p, int leng)
+{
+    static char *buf = NULL;
+    static int size = 0;
+    char *q;
+
+    if (3 * leng + 1 > size) {
+        size = 3 * leng + 1;
+        buf = xalloc(buf, size);
+    }
+    for (q = buf; leng-- > 0; q += 3)
+        sprintf(q, "%02x ", *p++);
+    if (q > buf)
+        q--;
+    *q = '\0';
+    return buf;
+}
+
+static void dtrstart(void)
+{
+    Curtrk++;
+    if (Curtrk >= Cur->ntrk || !Cur->trk[Curtrk].decode)
+        mf_skiptrack();
+}
+
+static void dnote(char *type, int chan, int pitch, int vol)
+{
+    char key[32], val[32];
+
+    sprintf(key, "%s ch=%d n=%d", type, chan+1, pitch);
+    sprintf(val, "v=%d", vol);
+    addevent(key, val);
+}
+
+static void don(int chan, int pitch, int vol)
+{
+    dnote("On", chan, pitch, vol);
+}
+
+static void doff(int chan, int pitch, int vol)
+{
+    dnote("Off", chan, pitch, vol);
+}
+
+static void dpressure(int chan, int pitch, int press)
+{
+    dnote("PoPr", chan, pitch, press);
+}
+
+static void dparameter(int chan, int control, int value)
+{
+    char key[32], val[32];
+
+    sprintf(key, "Par ch=%d c=%d", chan+1, control);
+    sprintf(val, "v=%d", value);
+    addevent(key, val);
+}
+
+static void dpitchbend(int chan, int lsb, int msb)
+{
+    char key[32], val[32];
+
+    sprintf(key, "Pb ch=%d", chan+1);
+    sprintf(val, "v=%d", 128*msb+lsb);
+    addevent(key, val);
+}
+
+static void dprogram(int chan, int program)
+{
+    char key[32], val[32];
+
+    sprintf(key, "PrCh ch=%d", chan+1);
+    sprintf(val, "p=%d", program);
+    addevent(key, val);
+}
+
+static void dchanpressure(int chan, int press)
+{
+    char key[32], val[32];
+
+    sprintf(key, "ChPr ch=%d", chan+1);
+    sprintf(val, "v=%d", press);
+    addevent(key, val);
+}
+
+static void dsysex(int leng, char *mess)
+{
+    addevent("SysEx", hex((unsigned char *)mess, leng));
+}
+
+static void darbitrary(int leng, char *mess)
+{
+    addevent("Arb", hex((unsigned char *)mess, leng));
+}
+
+static void dmetamisc(int type, int leng, char *mess)
+{
+    char key[32];
+
+    sprintf(key, "Meta 0x%02x", type);
+    addevent(key, hex((unsigned char *)mess, leng));
+}
+
+static void dsqspecific(int leng, char *mess)
+{
+    addevent("SeqSpec", hex((unsigned char *)mess, leng));
+}
+
+static void dtext(int type, int leng, char *mess)
+{
+    static char *ttype[] = {
+        NULL,
+        "Text", "Copyright", "TrkName", "InstrName", "Lyric", "Marker", "Cue"
+    };
+    unsigned char *p = (unsigned char *)mess;
+    char key[32];
+    char *buf, *q;
+    struct event *e;
+    int n;
+
+    if (type < 1 || type > 7)
+        sprintf(key, "Meta 0x%02x", type);
+    else
+        sprintf(key, "Meta %s", ttype[type]);
+    q = buf = mf_arena_alloc(Cur->arena, 4 * leng + 3);
+    *q++ = '"';
+    for (n = 0; n < leng; n++, p++) {
+        if (*p == '"' || *p == '\\') {
+            *q++ = '\\';
+            *q++ = *p;
+        } else if (*p < 0x20) {
+            sprintf(q, "\\x%02x", *p);
+            q += 4;
+        } else
+            *q++ = *p;
+    }
+    *q++ = '"';
+    *q = '\0';
+    buf = mf_arena_realloc(Cur->arena, buf, 4 * leng + 3, q - buf + 1);
+    e = newevent();
+    e->key = keep(key);
+    e->val = buf;
+    if (type == 3 && Cur->trk[Curtrk].name == NULL)
+        Cur->trk[Curtrk].name = buf;
+}
+
+static void dseqnum(int num)
+{
+    char val[32];
+
+    sprintf(val, "%d", num);
+    addevent("SeqNr", val);
+}
+
+static void deot(void)
+{
+    addevent("Meta TrkEnd", "");
+}
+
+static void dkeysig(int sf, int mi)
+{
+    char val[32];
+
+    sprintf(val, "%d %s", (sf>127?sf-256:sf), (mi?"minor":"major"));
+    addevent("KeySig", val);
+}
+
+static void dtempo(long tempo)
+{
+    char val[32];
+
+    sprintf(val, "%ld", tempo);
+    addevent("Tempo", val);
+}
+
+static void dtimesig(int nn, int dd, int cc, int bb)
+{
+    char val[32];
+    int denom = dd < 31 ? 1 << dd : 0;	/* 0 if too large to show */
+
+    sprintf(val, "%d/%d %d %d", nn, denom, cc, bb);
+    addevent("TimeSig", val);
+}
+
+static void dsmpte(int hr, int mn, int se, int fr, int ff)
+{
+    char val[32];
+
+    sprintf(val, "%d %d %d %d %d", hr, mn, se, fr, ff);
+    addevent("SMPTE", val);
+}
+
+static void decode(struct mfile *mf)
+{
+    Cur = mf;
+    Curtrk = -1;
+    Inp = mf->data;
+    Inend = mf->data + mf->size;
+    Mf_currtime = 0;
+    mfread();
+}
+
+static void initfuncs(void)
+{
+    Mf_getc = memgetc;
+    Mf_skip = memskip;
+    Mf_error = error;
+    Mf_starttrack = dtrstart;
+    Mf_on = don;
+    Mf_off = doff;
+    Mf_pressure = dpressure;
+    Mf_parameter = dparameter;
+    Mf_pitchbend = dpitchbend;
+    Mf_program = dprogram;
+    Mf_chanpressure = dchanpressure;
+    Mf_sysex = dsysex;
+    Mf_metamisc = dmetamisc;
+    Mf_seqnum = dseqnum;
+    Mf_eot = deot;
+    Mf_timesig = dtimesig;
+    Mf_smpte = dsmpte;
+    Mf_tempo = dtempo;
+    Mf_keysig = dkeysig;
+    Mf_sqspecific = dsqspecific;
+    Mf_text = dtext;
+    Mf_arbitrary = darbitrary;
+}
+
+static void pair(int i, int j)
+{
+    A.trk[i].pair = j;
+    B.trk[j].pair = i;
+}
+
+/* pair the tracks of the two files */
+static void align(void)
+{
+    int i, j;
+
+    /* equal bytes, in order */
+    for (i = 0; i < A.ntrk; i++)
+        for (j = 0; j < B.ntrk; j++)
+            if (B.trk[j].pair < 0 && A.trk[i].len == B.trk[j].len &&
+                    memcmp(A.trk[i].raw, B.trk[j].raw, A.trk[i].len) == 0) {
+                pair(i, j);
+                break;
+            }
+
+    for (i = 0; i < A.ntrk; i++)
+        A.trk[i].decode = A.trk[i].pair < 0;
+    for (j = 0; j < B.ntrk; j++)
+        B.trk[j].decode = B.trk[j].pair < 0;
+    decode(&A);
+    decode(&B);
+
+    /* the same track name */
+    for (i = 0; i < A.ntrk; i++) {
+        if (A.trk[i].pair >= 0 || A.trk[i].name == NULL)
+            continue;
+        for (j = 0; j < B.ntrk; j++)
+            if (B.trk[j].pair < 0 && B.trk[j].name &&
+                    strcmp(A.trk[i].name, B.trk[j].name) == 0) {
+                pair(i, j);
+                break;
+            }
+    }
+
+    /* the rest in order */
+    for (i = 0, j = 0; i < A.ntrk; i++) {
+        if (A.trk[i].pair >= 0)
+            continue;
+        while (j < B.ntrk && B.trk[j].pair >= 0)
+            j++;
+        if (j == B.ntrk)
+            break;
+        pair(i, j);
+    }
+}
+
+static void trackline(int i, int j, char *what)
+{
+    if (i >= 0 && j >= 0)
+        printf("Track %d -> %d%s\n", i+1, j+1, what);
+    else if (i >= 0)
+        printf("Track %d only in %s\n", i+1, A.path);
+    else
+        printf("Track %d only in %s\n", j+1, B.path);
+}
+
+/*
+ * Compare track i of the first file with track j of the second.  The
+ * events at each time are [ia,na) and [ib,nb).
+ */
+static void diffevents(struct track *ta, struct track *tb, int i, int j)
+{
+    struct event *a = ta->ev, *b = tb->ev;
+    long ia = 0, ib = 0, na, nb, x, y;
+    long t;
+    int header = 0;
+
+    while (ia < ta->nev || ib < tb->nev) {
+        if (ib >= tb->nev || (ia < ta->nev && a[ia].time < b[ib].time))
+            t = a[ia].time;
+        else
+            t = b[ib].time;
+        for (na = ia; na < ta->nev && a[na].time == t; na++)
+            ;
+        for (nb = ib; nb < tb->nev && b[nb].time == t; nb++)
+            ;
+
+        /* equal events */
+        for (x = ia; x < na; x++)
+            for (y = ib; y < nb; y++)
+                if (!b[y].matched && strcmp(a[x].key, b[y].key) == 0 &&
+                        strcmp(a[x].val, b[y].val) == 0) {
+                    a[x].matched = b[y].matched = 1;
+                    break;
+                }
+
+        for (x = ia; x < na; x++) {
+            if (a[x].matched)
+                continue;
+            Differ = 1;
+            if (quiet)
+                return;
+            if (!header++)
+                trackline(i, j, "");
+            for (y = ib; y < nb; y++)
+                if (!b[y].matched && strcmp(a[x].key, b[y].key) == 0)
+                    break;
+            if (y < nb) {
+                b[y].matched = 1;
+                printf("%ld ~ %s %s -> %s\n", t, a[x].key, a[x].val, b[y].val);
+            } else
+                printf("%ld - %s %s\n", t, a[x].key, a[x].val);
+        }
+        for (y = ib; y < nb; y++) {
+            if (b[y].matched)
+                continue;
+            Differ = 1;
+            if (quiet)
+                return;
+            if (!header++)
+                trackline(i, j, "");
+            printf("%ld + %s %s\n", t, b[y].key, b[y].val);
+        }
+        ia = na;
+        ib = nb;
+    }
+    if (!header && !quiet && (verbose || i != j))
+        trackline(i, j, " (same events)");
+}
+
+static void diff(void)
+{
+    int i, j;
+
+    if (A.format != B.format || A.ntrks != B.ntrks ||
+            A.division != B.division) {
+        Differ = 1;
+        if (quiet)
+            return;
+        printf("MFile %d %d %d -> MFile %d %d %d\n", A.format, A.ntrks,
+                A.division, B.format, B.ntrks, B.division);
+    }
+    for (i = 0; i < A.ntrk; i++) {
+        j = A.trk[i].pair;
+        if (j < 0) {
+            Differ = 1;
+            if (!quiet)
+                trackline(i, -1, "");
+        } else if (!A.trk[i].decode) {
+            /* the order of tracks matters only in a format 2 file */
+            if (i != j && A.format == 2)
+                Differ = 1;
+            if (!quiet && (verbose || i != j))
+                trackline(i, j, " (identical)");
+        } else
+            diffevents(&A.trk[i], &B.trk[j], i, j);
+        if (Differ && quiet)
+            return;
+    }
+    for (j = 0; j < B.ntrk; j++)
+        if (B.trk[j].pair < 0) {
+            Differ = 1;
+            if (!quiet)
+                trackline(-1, j, "");
+        }
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+"mfdiff v%s\n"
+"Usage: mfdiff [-qv] midifile1 midifile2\n\n"
+"Options:\n"
+"  -q      report only whether the files differ (by the exit status)\n"
+"  -v      also list the tracks that are the same\n", VERSION);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "qvh")) != -1) {
+        switch (c) {
+            case 'q':
+                quiet++;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case 'h':
+            case '?':
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+
+    load(&A, argv[optind]);
+    load(&B, argv[optind+1]);
+    if (A.size == B.size && memcmp(A.data, B.data, A.size) == 0)
+        return 0;
+
+    Mf_nomerge = 1;
+    initfuncs();
+    align();
+    diff();
+    return Differ;
+}
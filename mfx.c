@@ -0,0 +1,607 @@
+/*
+ * mfx
+ *
+ * Transform a MIDI file without going through the text: the events are
+ * decoded by the library, changed or dropped, and encoded again with
+ * mf_w_midi_event() and friends, one track at a time.  The transforms
+ * (channel remap, transpose, velocity scale, dropping events and
+ * controllers, selecting tracks) are all turned into tables before the
+ * file is read, so each event costs a few lookups.  So are the rules of
+ * a rule file (mfxrule.c), which are applied first.
+ *
+ * A track is encoded into memory and written when it is complete, so
+ * that its length is known; the output does not have to be seekable
+ * and can be a pipe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "midifile.h"
+#include "version.h"
+#include "getopt.h"
+#include "mfx.h"
+
+char *Typename[X_NTYPES] = {
+    "On", "Off", "PoPr", "Par", "Pb", "PrCh", "ChPr", "SysEx", "Arb",
+    "SeqNr", "Meta", "SeqSpec", "TrkEnd", "KeySig", "Tempo", "TimeSig",
+    "SMPTE"
+};
+
+/* the status of the channel messages, by kind */
+static int Status[X_NCHAN] = {
+    note_on, note_off, poly_aftertouch, control_change, pitch_wheel,
+    program_chng, channel_aftertouch
+};
+
+/* the tables */
+static int Chanmap[16];			/* new channel, -1 to drop */
+static int Notemap[16][128];		/* new note, -1 to drop */
+static int Velmap[128];			/* new note on velocity */
+static unsigned char Ctrldrop[16][128];	/* 1 to drop the controller */
+static long Dropmask;			/* 1 << X_... to drop the kind */
+static unsigned char *Keep;		/* tracks to write, from 1; NULL: all */
+static int Nkeep;
+
+static unsigned char *Inp, *Inend;
+static FILE *Out;
+static int TrkNr;
+static int Writing;			/* the current track is written */
+static long Lasttime;			/* of the last event written */
+static int Ended;			/* the last event was an End of Track */
+
+/* the encoded track */
+static unsigned char *Trk;
+static long Trklen, Trksize;
+
+static void *xalloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int trkputc(int c)
+{
+    if (Trklen == Trksize) {
+        Trksize = Trksize ? 2 * Trksize : 65536;
+        Trk = xalloc(Trk, Trksize);
+    }
+    return Trk[Trklen++] = c;
+}
+
+static void out32(unsigned long v)
+{
+    putc((int)(v >> 24) & 0xff, Out);
+    putc((int)(v >> 16) & 0xff, Out);
+    putc((int)(v >> 8) & 0xff, Out);
+    putc((int)v & 0xff, Out);
+}
+
+static void out16(int v)
+{
+    putc((v >> 8) & 0xff, Out);
+    putc(v & 0xff, Out);
+}
+
+static int memgetc(void)
+{
+    return Inp < Inend ? *Inp++ : EOF;
+}
+
+static void memskip(long n)
+{
+    Inp += n < Inend - Inp ? n : Inend - Inp;
+}
+
+static void error(char *s)
+{
+    fprintf(stderr, "mfx: %s\n", s);
+    exit(1);
+}
+
+/* the time since the last event written; and that is now this one */
+static unsigned long delta(void)
+{
+    unsigned long d = Mf_currtime - Lasttime;
+
+    Lasttime = Mf_currtime;
+    return d;
+}
+
+static int kept(int track)
+{
+    return Keep == NULL || (track < Nkeep && Keep[track]);
+}
+
+static void xheader(int format, int ntrks, int division)
+{
+    int i, n = 0;
+
+    for (i = 1; i <= ntrks; i++)
+        n += kept(i);
+    fwrite("MThd", 1, 4, Out);
+    out32(6);
+    out16(format);
+    out16(n);
+    out16(division);
+}
+
+static void xtrstart(void)
+{
+    TrkNr++;
+    Writing = kept(TrkNr);
+    if (!Writing) {
+        mf_skiptrack();
+        return;
+    }
+    Trklen = 0;
+    Lasttime = 0;
+    Ended = 0;
+    mf_w_bytes(Trk, 0);	/* no running status from the last track */
+    if (Nrules)
+        rulestrack(TrkNr);
+}
+
+static void xtrend(void)
+{
+    if (!Writing)
+        return;
+    if (!Ended)		/* as mfwrite() does */
+        mf_w_meta_event(delta(), end_of_track, NULL, 0);
+    fwrite("MTrk", 1, 4, Out);
+    out32(Trklen);
+    fwrite(Trk, 1, Trklen, Out);
+}
+
+/* the rules first, then the options */
+static void chanevent(int kind, int chan, int d1, int d2)
+{
+    unsigned char data[2];
+
+    /* a data byte of a bad file may have its top bit set */
+    d1 &= 0x7f;
+    d2 &= 0x7f;
+    Ended = 0;
+    if (Nrules && !ruleschan(&kind, &chan, &d1, &d2))
+        return;
+    if (Dropmask & (1L << kind) || Chanmap[chan] < 0)
+        return;
+    switch (kind) {
+        case X_ON:
+        case X_OFF:
+        case X_POPR:
+            if (Notemap[chan][d1] < 0)
+                return;
+            if (kind == X_ON)
+                d2 = Velmap[d2];
+            d1 = Notemap[chan][d1];
+            break;
+        case X_PAR:
+            if (Ctrldrop[chan][d1])
+                return;
+            break;
+    }
+    data[0] = d1;
+    data[1] = d2;
+    mf_w_midi_event(delta(), Status[kind], Chanmap[chan], data,
+            kind == X_PRCH || kind == X_CHPR ? 1 : 2);
+}
+
+static void xon(int chan, int pitch, int vol)
+{
+    chanevent(X_ON, chan, pitch, vol);
+}
+
+static void xoff(int chan, int pitch, int vol)
+{
+    chanevent(X_OFF, chan, pitch, vol);
+}
+
+static void xpressure(int chan, int pitch, int press)
+{
+    chanevent(X_POPR, chan, pitch, press);
+}
+
+static void xparameter(int chan, int control, int value)
+{
+    chanevent(X_PAR, chan, control, value);
+}
+
+static void xpitchbend(int chan, int lsb, int msb)
+{
+    chanevent(X_PB, chan, lsb, msb);
+}
+
+static void xprogram(int chan, int program)
+{
+    chanevent(X_PRCH, chan, program, 0);
+}
+
+static void xchanpressure(int chan, int press)
+{
+    chanevent(X_CHPR, chan, press, 0);
+}
+
+static void meta(int kind, int type, int leng, char *mess)
+{
+    Ended = type == end_of_track;
+    if (Dropmask & (1L << kind) || (Nrules && rulesdrop(kind)))
+        return;
+    mf_w_meta_event(delta(), type, (unsigned char *)mess, leng);
+}
+
+static void xsysex(int leng, char *mess)
+{
+    Ended = 0;
+    if (Dropmask & (1L << X_SYSEX) || (Nrules && rulesdrop(X_SYSEX)))
+        return;
+    /* the message starts with the f0 */
+    mf_w_sysex_event(delta(), (unsigned char *)mess, leng);
+}
+
+/* also the continuations of a sysex, as Mf_nomerge is 0 */
+static void xarbitrary(int leng, char *mess)
+{
+    static unsigned char *buf;
+    static int size;
+
+    Ended = 0;
+    if (Dropmask & (1L << X_ARB) || (Nrules && rulesdrop(X_ARB)))
+        return;
+    if (leng + 1 > size) {
+        size = leng + 1;
+        buf = xalloc(buf, size);
+    }
+    buf[0] = 0xf7;
+    memcpy(buf + 1, mess, leng);
+    mf_w_sysex_event(delta(), buf, leng + 1);
+}
+
+static void xmetamisc(int type, int leng, char *mess)
+{
+    meta(X_META, type, leng, mess);
+}
+
+static void xtext(int type, int leng, char *mess)
+{
+    meta(X_META, type, leng, mess);
+}
+
+static void xsqspecific(int leng, char *mess)
+{
+    meta(X_SEQSPEC, sequencer_specific, leng, mess);
+}
+
+static void xseqnum(int num)
+{
+    char m[2];
+
+    m[0] = num >> 8;
+    m[1] = num;
+    meta(X_SEQNR, sequence_number, 2, m);
+}
+
+static void xeot(void)
+{
+    meta(X_TRKEND, end_of_track, 0, NULL);
+}
+
+static void xkeysig(int sf, int mi)
+{
+    char m[2];
+
+    m[0] = sf;
+    m[1] = mi;
+    meta(X_KEYSIG, key_signature, 2, m);
+}
+
+static void xtempo(long tempo)
+{
+    char m[3];
+
+    m[0] = tempo >> 16;
+    m[1] = tempo >> 8;
+    m[2] = tempo;
+    meta(X_TEMPO, set_tempo, 3, m);
+}
+
+static void xtimesig(int nn, int dd, int cc, int bb)
+{
+    char m[4];
+
+    m[0] = nn;
+    m[1] = dd;
+    m[2] = cc;
+    m[3] = bb;
+    meta(X_TIMESIG, time_signature, 4, m);
+}
+
+static void xsmpte(int hr, int mn, int se, int fr, int ff)
+{
+    char m[5];
+
+    m[0] = hr;
+    m[1] = mn;
+    m[2] = se;
+    m[3] = fr;
+    m[4] = ff;
+    meta(X_SMPTE, smpte_offset, 5, m);
+}
+
+static void initfuncs(void)
+{
+    Mf_getc = memgetc;
+    Mf_skip = memskip;
+    Mf_putc = trkputc;
+    Mf_error = error;
+    Mf_header = xheader;
+    Mf_starttrack = xtrstart;
+    Mf_endtrack = xtrend;
+    Mf_on = xon;
+    Mf_off = xoff;
+    Mf_pressure = xpressure;
+    Mf_parameter = xparameter;
+    Mf_pitchbend = xpitchbend;
+    Mf_program = xprogram;
+    Mf_chanpressure = xchanpressure;
+    Mf_sysex = xsysex;
+    Mf_metamisc = xmetamisc;
+    Mf_seqnum = xseqnum;
+    Mf_eot = xeot;
+    Mf_timesig = xtimesig;
+    Mf_smpte = xsmpte;
+    Mf_tempo = xtempo;
+    Mf_keysig = xkeysig;
+    Mf_sqspecific = xsqspecific;
+    Mf_text = xtext;
+    Mf_arbitrary = xarbitrary;
+}
+
+/* the whole input, which may be a pipe */
+static void load(FILE *fp, char *name)
+{
+    unsigned char *data = NULL;
+    long len = 0, size = 0;
+    size_t n;
+
+    do {
+        if (len == size) {
+            size = size ? 2 * size : 65536;
+            data = xalloc(data, size);
+        }
+        n = fread(data + len, 1, size - len, fp);
+        len += n;
+    } while (n > 0);
+    if (ferror(fp)) {
+        fprintf(stderr, "mfx: %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    /* egetc() of the library takes the end of stdin for a premature EOF */
+    clearerr(fp);
+    Inp = data;
+    Inend = data + len;
+}
+
+/* a number from lo to hi at *s, followed by one of the chars in end */
+static int number(char **s, int lo, int hi, char *end)
+{
+    char *p;
+    long v = strtol(*s, &p, 10);
+
+    if (p == *s || v < lo || v > hi || !strchr(end, *p))
+        return -1;
+    *s = p;
+    return (int)v;
+}
+
+/* -c from=to */
+static int setchan(char *s)
+{
+    int from, to;
+
+    if ((from = number(&s, 1, 16, "=")) < 0)
+        return 0;
+    s++;
+    if ((to = number(&s, 1, 16, "")) < 0)
+        return 0;
+    Chanmap[from-1] = to-1;
+    return 1;
+}
+
+/* -t semitones; not on channel 10, which has the drums */
+static int settranspose(char *s)
+{
+    char *p;
+    long t = strtol(s, &p, 10);
+    int ch, n, m;
+
+    if (p == s || *p != '\0' || t < -127 || t > 127)
+        return 0;
+    for (ch = 0; ch < 16; ch++)
+        if (ch != 9)
+            for (n = 0; n < 128; n++)
+                if ((m = Notemap[ch][n]) >= 0)
+                    Notemap[ch][n] = m + t >= 0 && m + t < 128 ?
+                            (int)(m + t) : -1;
+    return 1;
+}
+
+/* -v percent */
+static int setvelocity(char *s)
+{
+    int pct, v, nv;
+
+    if ((pct = number(&s, 0, 1000, "")) < 0)
+        return 0;
+    for (v = 1; v < 128; v++) {
+        nv = (Velmap[v] * pct + 50) / 100;
+        Velmap[v] = nv < 1 ? 1 : nv > 127 ? 127 : nv;
+    }
+    return 1;
+}
+
+/* -d kind, -d c=n[-m] or -d ch=n */
+static int setdrop(char *s)
+{
+    int i, lo, hi;
+
+    if (strncmp(s, "ch=", 3) == 0) {
+        s += 3;
+        if ((lo = number(&s, 1, 16, "")) < 0)
+            return 0;
+        Chanmap[lo-1] = -1;
+        return 1;
+    }
+    if (strncmp(s, "c=", 2) == 0) {
+        s += 2;
+        if ((lo = number(&s, 0, 127, "-")) < 0)
+            return 0;
+        hi = lo;
+        if (*s == '-') {
+            s++;
+            if ((hi = number(&s, lo, 127, "")) < 0)
+                return 0;
+        }
+        for (; lo <= hi; lo++)
+            for (i = 0; i < 16; i++)
+                Ctrldrop[i][lo] = 1;
+        return 1;
+    }
+    for (i = 0; i < X_NTYPES; i++)
+        if (i != X_TRKEND && strcmp(s, Typename[i]) == 0) {
+            Dropmask |= 1L << i;
+            return 1;
+        }
+    return 0;
+}
+
+/* -k 1,3-5 */
+static int setkeep(char *s)
+{
+    int lo, hi;
+
+    for (;;) {
+        if ((lo = number(&s, 1, 65535, ",-")) < 0)
+            return 0;
+        hi = lo;
+        if (*s == '-') {
+            s++;
+            if ((hi = number(&s, lo, 65535, ",")) < 0)
+                return 0;
+        }
+        if (hi >= Nkeep) {
+            Keep = xalloc(Keep, hi + 1);
+            memset(Keep + Nkeep, 0, hi + 1 - Nkeep);
+            Nkeep = hi + 1;
+        }
+        for (; lo <= hi; lo++)
+            Keep[lo] = 1;
+        if (*s == '\0')
+            return 1;
+        s++;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+"mfx v%s\n"
+"Usage: mfx [-r] [-f rulefile] [-c from=to] [-t n] [-v percent] [-d what]\n"
+"           [-k tracks] [midifile [newfile]]\n\n"
+"Options:\n"
+"  -r          use running status\n"
+"  -f rulefile apply the rules in the file, before the other options\n"
+"  -c from=to  move the events of channel from to channel to\n"
+"  -t n        transpose the notes by n semitones, except on channel 10\n"
+"  -v percent  scale the velocities of note ons\n"
+"  -d what     drop events: a kind as in the text (Par, Pb, SysEx, ...),\n"
+"              controllers (c=7 or c=0-31) or a channel (ch=3)\n"
+"  -k tracks   write only these tracks, e.g. 1,3-5\n"
+"The options -f, -c, -d and -k may be repeated.\n", VERSION);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n;
+    char *name = "-";
+
+    for (i = 0; i < 16; i++) {
+        Chanmap[i] = i;
+        for (n = 0; n < 128; n++)
+            Notemap[i][n] = n;
+    }
+    for (n = 0; n < 128; n++)
+        Velmap[n] = n;
+
+    while ((c = getopt(argc, argv, "rf:c:t:v:d:k:h")) != -1) {
+        switch (c) {
+            case 'r':
+                Mf_RunStat = 1;
+                break;
+            case 'f':
+                ruleload(optarg);
+                break;
+            case 'c':
+                if (!setchan(optarg))
+                    usage();
+                break;
+            case 't':
+                if (!settranspose(optarg))
+                    usage();
+                break;
+            case 'v':
+                if (!setvelocity(optarg))
+                    usage();
+                break;
+            case 'd':
+                if (!setdrop(optarg))
+                    usage();
+                break;
+            case 'k':
+                if (!setkeep(optarg))
+                    usage();
+                break;
+            case 'h':
+            case '?':
+            default:
+                usage();
+        }
+    }
+    if (argc - optind > 2)
+        usage();
+
+    if (optind < argc && !freopen(name = argv[optind++], "rb", stdin)) {
+        fprintf(stderr, "freopen (%s): %s\n", argv[optind - 1],
+                strerror(errno));
+        exit(1);
+    }
+    if (optind < argc && !freopen(argv[optind], "wb", stdout)) {
+        fprintf(stderr, "freopen (%s): %s\n", argv[optind],
+                strerror(errno));
+        exit(1);
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    Out = stdout;
+
+    load(stdin, name);
+    initfuncs();
+    mfread();
+    if (fflush(Out) == EOF || ferror(Out)) {
+        fprintf(stderr, "mfx: write error: %s\n", strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
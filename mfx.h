@@ -0,0 +1,38 @@
+#ifndef MFX_H
+#define MFX_H
+
+/*
+ * Shared by mfx.c and mfxrule.c
+ */
+
+/* the kinds of events, as in the text; the channel messages first */
+#define X_ON		0
+#define X_OFF		1
+#define X_POPR		2
+#define X_PAR		3
+#define X_PB		4
+#define X_PRCH		5
+#define X_CHPR		6
+#define X_NCHAN		7	/* the number of kinds of channel messages */
+#define X_SYSEX		7
+#define X_ARB		8
+#define X_SEQNR		9
+#define X_META		10
+#define X_SEQSPEC	11
+#define X_TRKEND	12
+#define X_KEYSIG	13
+#define X_TEMPO		14
+#define X_TIMESIG	15
+#define X_SMPTE		16
+#define X_NTYPES	17
+
+extern char *Typename[X_NTYPES];
+
+/* mfxrule.c */
+extern int Nrules;
+extern void ruleload(char *name);
+extern void rulestrack(int track);
+extern int ruleschan(int *kind, int *chan, int *d1, int *d2);
+extern int rulesdrop(int kind);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ * mfxrule
+ *
+ * The rule file of mfx (-f file).  Each line is a rule: the events it
+ * applies to, followed by what to do with them, in the notation of the
+ * text:
+ *
+ *	c=3 drop
+ *	Off set On v=0
+ *	ch=10 map n=62:36,63:47,65:61,67:40,68:54
+ *	trk=3- ch=1 set ch=2
+ *
+ * Every rule is compiled into tables when it is read: bitsets of the
+ * channels and data bytes it matches, and a new value for every channel,
+ * data byte and velocity.  At the start of a track the rules for that
+ * track are collected, so an event costs a few lookups per rule that can
+ * apply to it, and nothing when no rule has its kind and channel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "mfx.h"
+
+#define BIT(k)		(1L << (k))
+#define NOTES		(BIT(X_ON) | BIT(X_OFF) | BIT(X_POPR))
+#define CHANNEL		(BIT(X_NCHAN) - 1)
+#define ALL		((BIT(X_NTYPES) - 1) & ~BIT(X_TRKEND))
+
+#define MAXRANGE	64	/* ranges in one list */
+
+/* the fields of the text a rule can use */
+#define F_TRK	0
+#define F_CH	1
+#define F_N	2
+#define F_C	3
+#define F_P	4
+#define F_V	5
+#define NFIELDS	6
+
+static struct field {
+    char *name;
+    long kinds;		/* the events that have it */
+} Fields[NFIELDS] = {
+    { "trk", ALL },
+    { "ch", CHANNEL },
+    { "n", NOTES },
+    { "c", BIT(X_PAR) },
+    { "p", BIT(X_PRCH) },
+    { "v", NOTES | BIT(X_PAR) | BIT(X_CHPR) },
+};
+
+struct rule {
+    long kinds;			/* the kinds it matches */
+    unsigned chans;		/* the channels it matches */
+    int (*trk)[2];		/* the tracks it matches; NULL: all */
+    int ntrk;
+    unsigned char key[16];	/* the values of n, c or p it matches */
+    unsigned char val[16];	/* the values of v it matches */
+    int drop;
+    int kind;			/* the new kind, or -1 */
+    int chmap[16];
+    int keymap[128];		/* the new n, c or p; -1 drops the event */
+    int valmap[128];		/* the new v */
+};
+
+int Nrules;
+static struct rule *Rules;
+static int Rulesize;
+
+/* the rules for the current track */
+static struct rule **Active;
+static int Nactive;
+static unsigned Touched[X_NCHAN];	/* the channels with rules, per kind */
+static long Dropkinds;			/* other kinds that are dropped */
+
+static char *Fname;
+static int Lineno;
+
+static void *xalloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void fail(char *fmt, char *word)
+{
+    fprintf(stderr, "%s:%d: ", Fname, Lineno);
+    fprintf(stderr, fmt, word);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+/* a number at *s */
+static int number(char **s, char *word)
+{
+    char *p;
+    long v = strtol(*s, &p, 10);
+
+    if (p == *s || **s == '+' || **s == '-' || v > 65535)
+        fail("bad number in %s", word);
+    *s = p;
+    return (int)v;
+}
+
+/* a list like 1,3-5 of numbers from lo to hi at s; 5- goes up to hi */
+static int list(char *s, int lo, int hi, int r[][2], char *word)
+{
+    int n = 0;
+
+    for (;;) {
+        if (n == MAXRANGE)
+            fail("too many ranges in %s", word);
+        r[n][0] = r[n][1] = number(&s, word);
+        if (*s == '-') {
+            s++;
+            r[n][1] = *s == ',' || *s == '\0' ? hi : number(&s, word);
+        }
+        if (r[n][0] < lo || r[n][1] > hi || r[n][0] > r[n][1])
+            fail("out of range: %s", word);
+        n++;
+        if (*s == '\0')
+            return n;
+        if (*s++ != ',')
+            fail("bad list in %s", word);
+    }
+}
+
+/* a kind or a list of kinds, e.g. On,Off; 0 if it is not one */
+static long kinds(char *word)
+{
+    char *s = word, *e;
+    long mask = 0;
+    int i;
+    size_t n;
+
+    do {
+        e = strchr(s, ',');
+        n = e ? (size_t)(e - s) : strlen(s);
+        for (i = 0; i < X_NTYPES; i++)
+            if (i != X_TRKEND && strlen(Typename[i]) == n &&
+                    strncmp(s, Typename[i], n) == 0)
+                break;
+        if (i == X_NTYPES)
+            return mask == 0 ? 0 : (fail("unknown kind in %s", word), 0);
+        mask |= BIT(i);
+        s = e + 1;
+    } while (e);
+    return mask;
+}
+
+/* the field at the start of word, followed by one of the chars in ops */
+static int field(char **word, char *ops)
+{
+    int f;
+    size_t n;
+
+    for (f = 0; f < NFIELDS; f++) {
+        n = strlen(Fields[f].name);
+        if (strncmp(*word, Fields[f].name, n) == 0 && (*word)[n] != '\0' &&
+                strchr(ops, (*word)[n])) {
+            *word += n;
+            return f;
+        }
+    }
+    return -1;
+}
+
+static void setbits(unsigned char *bits, int r[][2], int n)
+{
+    int i, k;
+
+    memset(bits, 0, 16);
+    for (i = 0; i < n; i++)
+        for (k = r[i][0]; k <= r[i][1]; k++)
+            bits[k >> 3] |= 1 << (k & 7);
+}
+
+static int clamp(int v)
+{
+    return v < 0 ? 0 : v > 127 ? 127 : v;
+}
+
+/* set n=36, n+12, v*80% and so on: change the map of the rule */
+static void setvalue(struct rule *r, int f, char *s, char *word)
+{
+    int *map = f == F_V ? r->valmap : r->keymap;
+    int op = *s++, k, i, m;
+
+    if (f == F_TRK)
+        fail("cannot set %s", word);
+    if (f == F_CH) {
+        if (op != '=' || (k = number(&s, word)) < 1 || k > 16 || *s)
+            fail("bad channel in %s", word);
+        for (i = 0; i < 16; i++)
+            r->chmap[i] = k - 1;
+        return;
+    }
+    k = number(&s, word);
+    if (op == '*' ? strcmp(s, "%") != 0 : *s != '\0')
+        fail("bad value in %s", word);
+    if (op == '=' && k > 127)
+        fail("out of range: %s", word);
+    if (op == '*' && f != F_V)
+        fail("only v can be scaled: %s", word);
+    for (i = 0; i < 128; i++) {
+        if ((m = map[i]) < 0)
+            continue;
+        switch (op) {
+            case '=':
+                m = k;
+                break;
+            case '+':
+                m += k;
+                break;
+            case '-':
+                m -= k;
+                break;
+            case '*':
+                m = m == 0 ? 0 : (m * k + 50) / 100 < 1 ? 1 :
+                        (m * k + 50) / 100;
+                break;
+        }
+        /* a note, controller or program that does not exist is dropped */
+        map[i] = f == F_V ? clamp(m) : m < 0 || m > 127 ? -1 : m;
+    }
+}
+
+/* map n=62:36,63:47: the values are replaced at the same time */
+static void mapvalues(struct rule *r, int f, char *s, char *word)
+{
+    int m[128], *map, i, a, b, hi = f == F_CH ? 16 : 127, base = f == F_CH;
+
+    if (f == F_TRK)
+        fail("cannot map %s", word);
+    for (i = 0; i < 128; i++)
+        m[i] = i;
+    for (;;) {
+        a = number(&s, word);
+        if (*s++ != ':')
+            fail("bad map in %s", word);
+        b = number(&s, word);
+        if (a < base || a > hi || b < base || b > hi)
+            fail("out of range: %s", word);
+        m[a - base] = b - base;
+        if (*s == '\0')
+            break;
+        if (*s++ != ',')
+            fail("bad map in %s", word);
+    }
+    map = f == F_CH ? r->chmap : f == F_V ? r->valmap : r->keymap;
+    for (i = 0; i < (f == F_CH ? 16 : 128); i++)
+        if (map[i] >= 0)
+            map[i] = m[map[i]];
+}
+
+static void compile(char *line)
+{
+    static int ranges[MAXRANGE][2];
+    struct rule *r;
+    char *word, *w, *s;
+    int f, i, n, used = 0, mode = 0;	/* 0: matches, else 's' or 'm' */
+    long given = 0, need = ALL, k;
+
+    if ((s = strchr(line, '#')) != NULL)
+        *s = '\0';
+    if ((word = strtok(line, " \t\r\n")) == NULL)
+        return;
+    if (Nrules == Rulesize) {
+        Rulesize = Rulesize ? 2 * Rulesize : 16;
+        Rules = xalloc(Rules, Rulesize * sizeof(*Rules));
+    }
+    r = &Rules[Nrules];
+    memset(r, 0, sizeof(*r));
+    r->chans = 0xffff;
+    memset(r->key, 0xff, 16);
+    memset(r->val, 0xff, 16);
+    r->kind = -1;
+    for (i = 0; i < 16; i++)
+        r->chmap[i] = i;
+    for (i = 0; i < 128; i++)
+        r->keymap[i] = r->valmap[i] = i;
+
+    for (; word; word = strtok(NULL, " \t\r\n")) {
+        w = word;
+        if (r->drop)
+            fail("nothing can follow drop: %s", word);
+        if (strcmp(word, "drop") == 0 && mode == 0) {
+            r->drop = 1;
+        } else if (strcmp(word, "set") == 0 || strcmp(word, "map") == 0) {
+            mode = word[0];
+        } else if (mode == 0 && (k = kinds(word)) != 0) {
+            given |= k;
+        } else if (mode == 0 && (f = field(&word, "=")) >= 0) {
+            n = list(word + 1, f == F_CH || f == F_TRK, f == F_CH ? 16 :
+                    f == F_TRK ? 65535 : 127, ranges, w);
+            if (f == F_TRK) {
+                r->trk = xalloc(r->trk, (r->ntrk + n) * sizeof(*r->trk));
+                memcpy(r->trk + r->ntrk, ranges, n * sizeof(*r->trk));
+                r->ntrk += n;
+            } else if (f == F_CH) {
+                for (r->chans = 0, i = 0; i < n; i++)
+                    for (k = ranges[i][0]; k <= ranges[i][1]; k++)
+                        r->chans |= 1 << (k - 1);
+            } else
+                setbits(f == F_V ? r->val : r->key, ranges, n);
+            used |= 1 << f;
+        } else if (mode == 's' && (k = kinds(word)) != 0) {
+            if (k & ~NOTES || k & (k - 1))
+                fail("only On, Off or PoPr can be set: %s", word);
+            r->kind = k == BIT(X_ON) ? X_ON : k == BIT(X_OFF) ? X_OFF : X_POPR;
+        } else if (mode == 's' && (f = field(&word, "=+-*")) >= 0) {
+            setvalue(r, f, word, w);
+            used |= 1 << f;
+        } else if (mode == 'm' && (f = field(&word, "=")) >= 0) {
+            mapvalues(r, f, word + 1, w);
+            used |= 1 << f;
+        } else
+            fail("unknown word %s", word);
+    }
+    if (mode == 0 && !r->drop)
+        fail("%s", "no action (drop, set or map)");
+
+    /* the events that have all the fields used; others cannot be set */
+    for (f = 0; f < NFIELDS; f++)
+        if (used & 1 << f)
+            need &= Fields[f].kinds;
+    if (!r->drop)
+        need &= CHANNEL;
+    if (r->kind >= 0) {
+        for (i = 0; i < X_NTYPES; i++)
+            if (given & ~NOTES & BIT(i))
+                fail("%s cannot become a note", Typename[i]);
+        need &= NOTES;
+    }
+    if (given) {
+        for (i = 0; i < X_NTYPES; i++)
+            if (given & ~need & BIT(i)) {
+                for (f = 0; f < NFIELDS; f++)
+                    if (used & 1 << f && !(Fields[f].kinds & BIT(i)))
+                        break;
+                if (f < NFIELDS) {
+                    fprintf(stderr, "%s:%d: %s has no %s\n", Fname, Lineno,
+                            Typename[i], Fields[f].name);
+                    exit(1);
+                }
+                fail("%s can only be dropped", Typename[i]);
+            }
+        r->kinds = given;
+    } else
+        r->kinds = need;
+    Nrules++;
+}
+
+/* read the rules of file name, after those read before */
+void ruleload(char *name)
+{
+    char line[1024];
+    FILE *fp;
+
+    if ((fp = fopen(name, "r")) == NULL) {
+        fprintf(stderr, "mfx: %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    Fname = name;
+    Lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        Lineno++;
+        if (strchr(line, '\n') == NULL && !feof(fp))
+            fail("%s", "line too long");
+        compile(line);
+    }
+    fclose(fp);
+}
+
+/* collect the rules for track (from 1) */
+void rulestrack(int track)
+{
+    struct rule *r;
+    int i, k;
+
+    if (Active == NULL)
+        Active = xalloc(NULL, (Nrules + 1) * sizeof(*Active));
+    Nactive = 0;
+    memset(Touched, 0, sizeof(Touched));
+    Dropkinds = 0;
+    for (r = Rules; r < Rules + Nrules; r++) {
+        if (r->trk) {
+            for (i = 0; i < r->ntrk; i++)
+                if (track >= r->trk[i][0] && track <= r->trk[i][1])
+                    break;
+            if (i == r->ntrk)
+                continue;
+        }
+        Active[Nactive++] = r;
+        for (k = 0; k < X_NCHAN; k++)
+            if (r->kinds & BIT(k))
+                Touched[k] |= r->chans;
+        if (r->drop)
+            Dropkinds |= r->kinds & ~CHANNEL;
+    }
+}
+
+/*
+ * Apply the rules of the track to a channel message, in order, each to
+ * the result of those before it; 0 if it is dropped.  The value (v) of
+ * ChPr is its first data byte.  Data bytes are taken as 7 bits.
+ */
+int ruleschan(int *kind, int *chan, int *d1, int *d2)
+{
+    struct rule *r;
+    int i, *v;
+
+    /* the tables have 128 entries */
+    *d1 &= 0x7f;
+    *d2 &= 0x7f;
+    /* no rule can change it when none matches it as it is */
+    if (!(Touched[*kind] >> *chan & 1))
+        return 1;
+    for (i = 0; i < Nactive; i++) {
+        r = Active[i];
+        v = *kind == X_CHPR ? d1 : d2;
+        if (!(r->kinds & BIT(*kind)) || !(r->chans >> *chan & 1) ||
+                !(r->key[*d1 >> 3] >> (*d1 & 7) & 1) ||
+                !(r->val[*v >> 3] >> (*v & 7) & 1))
+            continue;
+        if (r->drop || r->keymap[*d1] < 0)
+            return 0;
+        *d1 = r->keymap[*d1];
+        *v = r->valmap[*v];
+        *chan = r->chmap[*chan];
+        if (r->kind >= 0)
+            *kind = r->kind;
+    }
+    return 1;
+}
+
+/* whether the rules of the track drop the events of another kind */
+int rulesdrop(int kind)
+{
+    return Dropkinds >> kind & 1;
+}
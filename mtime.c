@@ -0,0 +1,84 @@
+/*
+ * mtime
+ *
+ * Bar:beat:click bookkeeping for mf2t and t2mf.
+ */
+
+#include "mtime.h"
+
+void mt_init(struct mtime *mt, int clicks)
+{
+    mt->clicks = clicks;
+    mt->measure = 4;
+    mt->beat = clicks;
+    mt->m0 = 0;
+    mt->t0 = 0;
+    mt->valid = 0;
+}
+
+/*
+ * A time signature starts a new bar at `time'.  Any part of a bar that
+ * has not been completed under the old signature is dropped.
+ */
+void mt_timesig(struct mtime *mt, long time, int nn, int denom)
+{
+    mt->m0 += (time-mt->t0)/(mt->beat*mt->measure);
+    mt->t0 = time;
+    mt->measure = nn;
+    mt->beat = 4 * mt->clicks / denom;
+
+    mt->valid = 1;
+    mt->time = time;
+    mt->bar = mt->m0;
+    mt->beatnr = 0;
+    mt->click = 0;
+}
+
+/*
+ * Events arrive in time order with small gaps, so the position of the
+ * previous call is carried forward: a step of less than one beat needs
+ * at most one carry into the beat and bar counters.  Only for larger
+ * steps, or when the time goes back (a new track), is the position
+ * computed from scratch with divisions.
+ */
+void mt_position(struct mtime *mt, long time,
+        long *bar, long *beat, long *click)
+{
+    long d = time - mt->time;
+
+    if (mt->valid && d >= 0 && d < mt->beat) {
+        mt->time = time;
+        mt->click += d;
+        if (mt->click >= mt->beat) {
+            mt->click -= mt->beat;
+            if (++mt->beatnr >= mt->measure) {
+                mt->beatnr = 0;
+                mt->bar++;
+            }
+        }
+    } else {
+        long m = (time-mt->t0)/mt->beat;
+
+        mt->time = time;
+        mt->bar = m/mt->measure + mt->m0;
+        mt->beatnr = m%mt->measure;
+        mt->click = (time-mt->t0)%mt->beat;
+        /* before the time signature the counters run backwards */
+        mt->valid = (time >= mt->t0);
+    }
+    *bar = mt->bar;
+    *beat = mt->beatnr;
+    *click = mt->click;
+}
+
+long mt_ticks(struct mtime *mt, long bar, long beat, long click)
+{
+    return mt->t0 + ((bar-mt->m0)*mt->measure + beat)*mt->beat + click;
+}
+
+/* Do a and b convert times in the same way? */
+int mt_same(struct mtime *a, struct mtime *b)
+{
+    return a->clicks == b->clicks && a->measure == b->measure &&
+        a->beat == b->beat && a->m0 == b->m0 && a->t0 == b->t0;
+}
@@ -0,0 +1,30 @@
+#ifndef MTIME_H
+#define MTIME_H
+
+/*
+ * Conversion between ticks and bar:beat:click times, shared by mf2t
+ * and t2mf.  Bars are counted from the last time signature, so the
+ * state consists of the time and bar number of that time signature
+ * together with its bar length and beat length.
+ */
+
+struct mtime {
+    int clicks;		/* clicks per quarter note (the division) */
+    int measure;	/* beats per bar */
+    int beat;		/* clicks per beat */
+    int m0;		/* bar number at the last time signature */
+    long t0;		/* time of the last time signature */
+
+    /* the last time converted by mt_position() and its result */
+    int valid;
+    long time, bar, beatnr, click;
+};
+
+extern void mt_init(struct mtime *mt, int clicks);
+extern void mt_timesig(struct mtime *mt, long time, int nn, int denom);
+extern void mt_position(struct mtime *mt, long time,
+        long *bar, long *beat, long *click);
+extern long mt_ticks(struct mtime *mt, long bar, long beat, long click);
+extern int mt_same(struct mtime *a, struct mtime *b);
+
+#endif
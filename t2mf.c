@@ -1,151 +1,623 @@
 /* $Id: t2mf.c,v 1.5 1995/12/14 21:58:36 piet Rel piet $ */
 /*
  * t2mf
- * 
+ *
  * Convert text to a MIDI file.
+ *
+ * Each track is parsed into a list of events in a struct track, and the
+ * events are written when the library asks for the track.  With more
+ * than one thread the tracks are parsed in parallel (see t2mfpar.c).
+ *
+ * The parse functions return -1 after an error; the rest of the line is
+ * then skipped and parsing goes on with the next line.  With -c only the
+ * errors are reported, with the file, line and column.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 //#include <unistd.h>
 #include <io.h>
 #include <errno.h>
 #include <ctype.h>
-#include <setjmp.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#endif
 #include "t2mf.h"
+#include "mtime.h"
 #include "version.h"
 //#include "getopt.h"
 
 
 extern int optind;
-
-#ifdef NO_YYLENG_VAR
-#define	yyleng yylength
-#endif
-
-static jmp_buf erjump;
-static int err_cont = 0;
+extern char *optarg;
 
 static int TrkNr;
-static int Format, Ntrks;
-static int Measure, M0, Beat, Clicks;
-static long T0;
-static char* buffer = 0;
-static int bufsiz = 0, buflen;
-
-extern int yylex(void);
-extern long yyval;
-extern int yyleng;
-extern int lineno;
-extern char *yytext;
-extern int do_hex;
-extern int eol_seen;
-extern FILE  *yyin;
-
-static void mywritetrack();
-static void checkchan();
-static void checknote();
-static void checkval();
-static void splitval();
-static void get16val();
-static void checkcon();
-static void checkprog();
-static void checkeol();
-static void gethex();
+static int Format, Ntrks, Clicks;
+static int Nthreads = 0;
+static int Sort = 0;		/* sort the events of each track by time */
+static char *Cachefile = NULL;	/* the track cache (-C) */
+static unsigned char *Cap;	/* the bytes of the track being written */
+static long Caplen, Capsiz;
+static int Capture = 0;
+static char *Fname = NULL;	/* the file that is checked (-c) */
+static struct track Hdr;	/* the header, then the scanner of the rest */
+static struct track *Trk;	/* the parsed tracks */
+static int Trksiz;		/* and the room for them */
+static char *Input;		/* the text */
+static int Tokens;		/* or the tokens of mf2t -T */
+static char *Outpattern = NULL;	/* -m: the names of the MIDI files */
+static char Outname[FILENAME_MAX];	/* the name given with MFile */
+static FILE *Out;		/* the MIDI file being written */
+
+static int checkchan(struct track *T);
+static int checknote(struct track *T);
+static int checkval(struct track *T);
+static int splitval(struct track *T);
+static int get16val(struct track *T);
+static int checkcon(struct track *T);
+static int checkprog(struct track *T);
+static int checkeol(struct track *T);
+static int gethex(struct track *T);
+static void sortevents(struct track *T);
+static void secstoticks(void);
 
 void error(char *s)
 {
     fprintf(stderr, "Error: %s\n", s);
 }
 
-static void prs_error(char *s)
+void *grow(void *p, long size)
+{
+    p = p ? realloc(p, size) : malloc(size);
+    if (p == NULL) {
+        error("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+/* The messages are kept with the track and shown when it is written */
+static void tmsg(struct track *T, char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(T->msg ? T->msg + T->msglen : NULL,
+                T->msgsiz - T->msglen, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && n < T->msgsiz - T->msglen)
+            break;
+        T->msgsiz = T->msgsiz ? 2 * T->msgsiz : 256;
+        T->msg = grow(T->msg, T->msgsiz);
+    }
+    T->msglen += n;
+}
+
+/* an error at the last token */
+static void terror(struct track *T, char *s)
+{
+    if (Fname)
+        tmsg(T, "%s:%d:%d: %s\n", Fname, T->sc.tline, T->sc.tcol, s);
+    else
+        tmsg(T, "Error: %s\n", s);
+}
+
+/* an error in the record at offset off of a token file */
+void tokerror(struct track *T, long off, char *s)
+{
+    if (Fname)
+        tmsg(T, "%s: byte %ld: %s\n", Fname, off, s);
+    else
+        tmsg(T, "Error: byte %ld: %s\n", off, s);
+}
+
+/* show the messages from `from' up to `to' */
+static void showmsg(struct track *T, long from, long to)
+{
+    if (to > from)
+        fwrite(T->msg + from, 1, to - from, stderr);
+}
+
+static int lex(struct track *T)
+{
+    int c = scan(&T->sc);
+
+    if (T->sc.msg) {
+        terror(T, T->sc.msg);
+        T->sc.msg = NULL;
+    }
+    return c;
+}
+
+/*
+ * Report an error at the last token and skip the rest of the line.  At
+ * the end of the input the track cannot be finished: T->status becomes
+ * T_FATAL.  Returns -1 for the callers to pass on.
+ */
+static int prs_error(struct track *T, char *s)
 {
     int c;
     int count;
-    int ln = (eol_seen? lineno-1 : lineno);
-    fprintf(stderr, "%d: %s\n", ln, s);
-    if (yyleng > 0 && *yytext != '\n')
-        fprintf(stderr, "*** %*s ***\n", yyleng, yytext);
+    int ln = (T->sc.eol? T->sc.line-1 : T->sc.line);
+    int leng = (T->sc.leng > 0 && *T->sc.text != '\n') ? T->sc.leng : 0;
+    if (Fname) {
+        tmsg(T, "%s:%d:%d: %s", Fname, T->sc.tline, T->sc.tcol, s);
+        for (count = 0; count < leng && count < 40; count++)
+            if (T->sc.text[count] == '\n' || T->sc.text[count] == '\r')
+                break;
+        leng = count;
+        if (leng > 0)
+            tmsg(T, " at \"%.*s\"", leng, T->sc.text);
+        tmsg(T, "\n");
+    } else {
+        tmsg(T, "%d: %s\n", ln, s);
+        if (leng > 0)
+            tmsg(T, "*** %.*s ***\n", leng, T->sc.text);
+    }
     count = 0;
     /* skip rest of line */
-    while (count < 100 && (c=yylex()) != EOL && c != EOF) count++;
-    if (c == EOF) exit(1);
-    if (err_cont)
-        longjmp(erjump, 1);
+    while (count < 100 && (c=lex(T)) != EOL && c != EOF) count++;
+    if (c == EOF)
+        T->status = T_FATAL;
+    return -1;
+}
+
+static int syntax(struct track *T)
+{
+    return prs_error(T, "Syntax error");
 }
 
-static void syntax(void)
+/* the rest of a line after an error outside the events */
+static void skipline(struct track *T)
 {
-    prs_error("Syntax error");
+    while (! T->sc.eol && T->status != T_FATAL && lex(T) != EOF)
+        ;
 }
 
-static int getint(char *mess)
+static int getint(struct track *T, char *mess)
 {
     char ermesg[100];
-    if (yylex() != INT) {
+    if (lex(T) != INT) {
         sprintf(ermesg, "Integer expected for %s", mess);
-        error(ermesg);
-        yyval = 0;
+        terror(T, ermesg);
+        T->sc.val = 0;
     }
-    return yyval;
+    return T->sc.val;
 }
 
-static int getbyte(char *mess)
+static int getbyte(struct track *T, char *mess)
 {
     char ermesg[100];
-    getint(mess);
-    if (yyval < 0 || yyval > 127) {
-        sprintf(ermesg, "Wrong value (%ld) for %s", yyval, mess);
-        error(ermesg);
-        yyval = 0;
+    getint(T, mess);
+    if (T->sc.val < 0 || T->sc.val > 127) {
+        sprintf(ermesg, "Wrong value (%ld) for %s", T->sc.val, mess);
+        terror(T, ermesg);
+        T->sc.val = 0;
     }
-    return yyval;
+    return T->sc.val;
 }
 
-static void translate(void)
+void reserve(struct track *T, long n)
 {
-    int c;
+    if (T->poollen + n > T->poolsiz) {
+        while (T->poollen + n > T->poolsiz)
+            T->poolsiz = T->poolsiz ? 2 * T->poolsiz : 1024;
+        T->pool = grow(T->pool, T->poolsiz);
+    }
+}
+
+/* add an event with the data from off to the end of the pool */
+struct event *addevent(struct track *T, unsigned long time,
+        int kind, int type, long off)
+{
+    struct event *e;
+
+    if (T->nev >= T->evsiz) {
+        T->evsiz = T->evsiz ? 2 * T->evsiz : 256;
+        T->ev = grow(T->ev, T->evsiz * sizeof(struct event));
+    }
+    e = &T->ev[T->nev++];
+    e->time = time;
+    e->kind = kind;
+    e->type = type;
+    e->chan = T->chan;
+    e->off = off;
+    e->len = T->poollen - off;
+    e->msglen = T->msglen;
+    return e;
+}
+
+/* an event with n bytes from data[] */
+static void dataevent(struct track *T, unsigned long time, int kind,
+        int type, long n)
+{
+    long off = T->poollen;
+
+    reserve(T, n);
+    memcpy(T->pool + off, T->data, n);
+    T->poollen += n;
+    addevent(T, time, kind, type, off);
+}
+
+/* the options that change how a track is encoded */
+static int cacheopts(void)
+{
+    return (Mf_RunStat ? 1 : 0) | (Sort ? 2 : 0);
+}
+
+/* Mf_putc with -C: keep the bytes of a track for the cache */
+static int cacheputc(int c)
+{
+    if (Capture) {
+        if (Caplen >= Capsiz) {
+            Capsiz = Capsiz ? 2 * Capsiz : 4096;
+            Cap = grow(Cap, Capsiz);
+        }
+        Cap[Caplen++] = c;
+    }
+    return putc(c, Out);
+}
+
+static int outputc(int c)
+{
+    return putc(c, Out);
+}
+
+/* Empty T for the next document, but keep its buffers */
+static void cleartrack(struct track *T)
+{
+    struct track t = *T;
+
+    memset(T, 0, sizeof(struct track));
+    T->ev = t.ev;
+    T->evsiz = t.evsiz;
+    T->pool = t.pool;
+    T->poolsiz = t.poolsiz;
+    T->msg = t.msg;
+    T->msgsiz = t.msgsiz;
+    T->sec = t.sec;
+    T->secsiz = t.secsiz;
+}
+
+/*
+ * Read the text in fp and set up the scanner of Hdr, which also keeps
+ * the position in a token file.  Returns -1 when the text starts with an
+ * unknown byte order mark.
+ */
+static int readfile(FILE *fp)
+{
+    struct track *T = &Hdr;
+    char *buf;
+    long len;
+
+    cleartrack(T);
+    Input = buf = readinput(fp, &len);
+    scaninit(&T->sc, buf, len);
+    if ((Tokens = istokens(buf, len)) != 0)
+        return 0;
 
     /* Skip byte order mark */
-    if ((c = getchar()) == 0xef) {
-        if (getchar() != 0xbb || getchar() != 0xbf) {
-            error("Unknown byte order mark");
-            exit(1);
+    if (len > 0 && (unsigned char)buf[0] == 0xef) {
+        if (len < 3 || (unsigned char)buf[1] != 0xbb ||
+                (unsigned char)buf[2] != 0xbf) {
+            terror(T, "Unknown byte order mark");
+            return -1;
         }
-    } else
-        ungetc(c, stdin);
+        scaninit(&T->sc, buf + 3, len - 3);
+    }
+    return 0;
+}
+
+/* the name of the MIDI file for an MFile with -m */
+static int getname(struct track *T)
+{
+    int c = lex(T), n = T->sc.leng - 1, i;
+
+    if (c == EOL)
+        return 0;
+    if (c != STRING)
+        return prs_error(T, "Garbage deleted");
+    if (n >= (int)sizeof(Outname))
+        return prs_error(T, "File name too long");
+    /* the text may come from anywhere: no writing outside the directory */
+    for (i = 0; i < n; i++)
+        if (T->sc.text[i] == '/' || T->sc.text[i] == '\\' ||
+                (T->sc.text[i] == '.' && i + 1 < n && T->sc.text[i+1] == '.'))
+            return prs_error(T, "File name must not have a directory");
+    if (n == 0)
+        return prs_error(T, "Empty file name");
+    memcpy(Outname, T->sc.text, n);
+    Outname[n] = '\0';
+    return checkeol(T);
+}
+
+/* Room for n empty tracks in Trk[] */
+static void newtracks(int n)
+{
+    int t;
+
+    if (n + 1 > Trksiz) {
+        Trk = grow(Trk, (n + 1) * sizeof(struct track));
+        memset(Trk + Trksiz, 0, (n + 1 - Trksiz) * sizeof(struct track));
+        Trksiz = n + 1;
+    }
+    for (t = 0; t <= n; t++)
+        cleartrack(&Trk[t]);
+}
+
+/* parsedoc() for a token file: the tracks are simply read in order */
+static int tokdoc(void)
+{
+    struct track *T = &Hdr;
+    int t;
+
+    T->status = T_OK;
+    T->msglen = 0;
+    Ntrks = 0;
+    Outname[0] = '\0';
+    if (Outpattern && T->sc.p == T->sc.end)
+        return 0;
+    if (tokheader(T, &Format, &Ntrks, &Clicks) < 0)
+        return -1;
+    newtracks(Ntrks);
+    for (t = 0; t < Ntrks; t++) {
+        struct track *B = &Trk[t];
+
+        B->sc = T->sc;
+        toktrack(B);
+        T->sc = B->sc;
+        if (Sort)
+            sortevents(B);
+        if (B->status == T_FATAL)
+            break;
+    }
+    return 1;
+}
+
+/*
+ * Parse the next document of the text: the header into Hdr and the tracks
+ * into Trk[], which keep their buffers from the last one.  Returns 1 for
+ * a document, 0 at the end of the text (only with -m), and -1 when the
+ * header is wrong and no tracks were parsed.
+ */
+static int parsedoc(void)
+{
+    struct track *T = &Hdr;
+    struct track **redo;
+    char *end;
+    int t, n, nb, nredo, c, r;
+
+    if (Tokens)
+        return tokdoc();
+    mt_init(&T->mt, 96);
+    T->status = T_OK;
+    T->msglen = 0;
+    Ntrks = 0;
+    Outname[0] = '\0';
 
-    if (yylex()==MTHD) {
-        Format = getint("MFile format");
-        Ntrks = getint("MFile #tracks");
-        Clicks = getint("MFile Clicks");
+    c = lex(T);
+    if (Outpattern) {
+        while (c == EOL)
+            c = lex(T);
+        if (c == EOF)
+            return 0;
+    }
+    if (c == MTHD) {
+        Format = getint(T, "MFile format");
+        Ntrks = getint(T, "MFile #tracks");
+        Clicks = getint(T, "MFile Clicks");
         if (Clicks < 0)
-            Clicks = (Clicks&0xff)<<8|getint("MFile SMPTE division");
-        checkeol();
-        mfwrite(Format, Ntrks, Clicks, stdout);
+            Clicks = (Clicks&0xff)<<8|getint(T, "MFile SMPTE division");
+        else
+            mt_init(&T->mt, Clicks);
+        if (Outpattern && !T->sc.eol)
+            r = getname(T);
+        else
+            r = checkeol(T);
+        if (r < 0)
+            skipline(T);
+        if (T->status == T_FATAL)
+            return -1;
     } else {
-        fprintf(stderr, "Missing MFile – can’t continue\n");
+        if (Fname)
+            terror(T, "Missing MFile");
+        else
+            tmsg(T, "Missing MFile – can’t continue\n");
+        return -1;
+    }
+
+    n = Ntrks > 0 ? Ntrks : 0;
+    newtracks(n);
+    redo = grow(NULL, (n + 1) * sizeof(struct track *));
+
+    /*
+     * Guess where the tracks are, look them up in the cache and parse the
+     * others in parallel, all with the time signature state of the header.
+     */
+    nb = 0;
+    if ((Nthreads > 1 && n > 1) || Cachefile) {
+        nb = splittracks(T->sc.p, T->sc.end, T->sc.line, Trk, n);
+        for (nredo = t = 0; t < nb; t++) {
+            struct track *B = &Trk[t];
+
+            if (Cachefile && (B->hit = cachefind(B->sc.p,
+                    B->sc.end - B->sc.p, cacheopts())) != NULL) {
+                B->start = B->sc.p;
+                B->end = B->sc.end;
+            } else if (Nthreads > 1) {
+                B->mtin = T->mt;
+                redo[nredo++] = B;
+            }
+        }
+        parsetracks(redo, nredo, Nthreads);
+    }
+
+    /*
+     * Then follow the input in order.  A track from the cache or one that
+     * was parsed in parallel is used when it starts where the previous
+     * one ended (and was parsed up to its TrkEnd); otherwise it is parsed
+     * here.  When it depends on a time signature in an earlier track it
+     * is parsed again, later if it does not change the time signature
+     * itself.
+     */
+    nredo = 0;
+    for (t = 0; t < n; t++) {
+        struct track *B = &Trk[t];
+
+        if (B->hit && (B->start != T->sc.p || (B->hit->mtused &&
+                !mt_same(&B->hit->mtin, &T->mt)))) {
+            B->hit = NULL;
+            B->start = NULL;
+        }
+        if (B->hit) {
+            end = T->sc.end;
+            scaninit(&T->sc, B->end, end - B->end);
+            T->sc.line = B->endline;
+            B->mtin = T->mt;
+            if (B->hit->mtset)
+                T->mt = B->hit->mt;
+            B->hit->used = 1;
+        } else if (t < nb && B->start == T->sc.p && B->status == T_OK &&
+                B->end == B->sc.end) {
+            end = T->sc.end;
+            T->sc = B->sc;
+            T->sc.end = end;
+            if (B->mtused && !mt_same(&B->mtin, &T->mt)) {
+                B->mtin = T->mt;
+                scaninit(&B->sc, B->start, B->end - B->start);
+                B->sc.line = B->line;
+                if (B->mtset)
+                    parsetrack(B);
+                else
+                    redo[nredo++] = B;
+            }
+            if (B->mtset)
+                T->mt = B->mt;
+        } else {
+            B->sc = T->sc;
+            B->mtin = T->mt;
+            parsetrack(B);
+            T->sc = B->sc;
+            T->mt = B->mt;
+            if (B->status == T_FATAL)
+                break;
+        }
+    }
+    parsetracks(redo, nredo, Nthreads);
+    free(redo);
+    secstoticks();
+    return 1;
+}
+
+/*
+ * Open the MIDI file for document number doc with -m; a name from the
+ * MFile line is in the directory of the pattern
+ */
+static void openout(int doc)
+{
+    char name[FILENAME_MAX];
+    char *p, *dir = Outpattern;
+    int n;
+
+    for (p = Outpattern; *p; p++)
+        if (*p == '/' || *p == '\\')
+            dir = p + 1;
+    if (Outname[0] == '\0')
+        n = snprintf(name, sizeof(name), Outpattern, doc);
+    else
+        n = snprintf(name, sizeof(name), "%.*s%s", (int)(dir - Outpattern),
+                Outpattern, Outname);
+    if (n < 0 || n >= (int)sizeof(name)) {
+        fprintf(stderr, "File name too long\n");
+        exit(1);
+    }
+    if ((Out = fopen(name, "wb")) == NULL) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+}
+
+static void translate(void)
+{
+    int r, doc = 0;
+
+    if (Cachefile)
+        cacheload(Cachefile);
+    Out = stdout;
+    if (readfile(stdin) < 0) {
+        showmsg(&Hdr, 0, Hdr.msglen);
         exit(1);
     }
+    while ((r = parsedoc()) != 0) {
+        showmsg(&Hdr, 0, Hdr.msglen);
+        if (r < 0)
+            exit(1);
+        if (Outpattern)
+            openout(++doc);
+        TrkNr = 0;
+        mfwrite(Format, Ntrks, Clicks, Out);
+        if (!Outpattern)
+            break;
+        if (fclose(Out) != 0) {
+            perror("t2mf");
+            exit(1);
+        }
+    }
+    if (Cachefile && !Tokens && cachesave(Cachefile) < 0)
+        fprintf(stderr, "%s: %s\n", Cachefile, strerror(errno));
 }
 
-char data[5];
-int chan;
+/*
+ * t2mf -c: parse a file and report all errors, but write nothing.  With
+ * -m all the documents in it are checked.  Returns 1 when there were
+ * errors.
+ */
+static int check(FILE *fp, char *name)
+{
+    int t, r, errors = 0;
+
+    Fname = name;
+    if (readfile(fp) < 0) {
+        showmsg(&Hdr, 0, Hdr.msglen);
+        errors = 1;
+    } else {
+        while ((r = parsedoc()) != 0) {
+            showmsg(&Hdr, 0, Hdr.msglen);
+            errors |= (r < 0 || Hdr.msglen > 0);
+            if (r < 0)
+                break;
+            for (t = 0; t < Ntrks; t++) {
+                showmsg(&Trk[t], 0, Trk[t].msglen);
+                errors |= (Trk[t].msglen > 0 || Trk[t].status != T_OK);
+            }
+            if (!Outpattern)
+                break;
+        }
+    }
+    free(Input);
+    return errors;
+}
 
-static void checkchan()
+static int checkchan(struct track *T)
 {
-    if (yylex() != CH || yylex() != INT) syntax();
-    if (yyval < 1 || yyval > 16)
-        error("Chan must be between 1 and 16");
-    chan = yyval-1;
+    if (lex(T) != CH || lex(T) != INT) return syntax(T);
+    if (T->sc.val < 1 || T->sc.val > 16)
+        terror(T, "Chan must be between 1 and 16");
+    T->chan = T->sc.val-1;
+    return 0;
 }
 
-static void checknote()
+static int checknote(struct track *T)
 {
     int c;
-    if (yylex() != NOTE || ((c=yylex()) != INT && c != NOTEVAL))
-        syntax();
+    long val;
+    if (lex(T) != NOTE || ((c=lex(T)) != INT && c != NOTEVAL))
+        return syntax(T);
+    val = T->sc.val;
     if (c == NOTEVAL) {
         static int notes[] = {
             9,   /* a */
@@ -156,104 +628,109 @@ static void checknote()
             5,   /* f */
             7    /* g */
         };
-        char *p = yytext;
+        char *p = T->sc.text;
         c = *p++;
         if (isupper(c)) c = tolower(c);
-        yyval = notes[c-'a'];
+        val = notes[c-'a'];
         switch (*p) {
             case '#':
             case '+':
-                yyval++;
+                val++;
                 p++;
                 break;
             case 'b':
             case 'B':
             case '-':
-                yyval--;
+                val--;
                 p++;
                 break;
-        }	
-        yyval += 12 * atoi(p);
+        }
+        val += 12 * atoi(p);
     }
-    if (yyval < 0 || yyval > 127)
-        error("Note must be between 0 and 127");
-    data[0] = yyval;
+    if (val < 0 || val > 127)
+        terror(T, "Note must be between 0 and 127");
+    T->data[0] = val;
+    return 0;
 }
 
-static void checkval()
+static int checkval(struct track *T)
 {
-    if (yylex() != VAL || yylex() != INT) syntax();
-    if (yyval < 0 || yyval > 127)
-        error("Value must be between 0 and 127");
-    data[1] = yyval;
+    if (lex(T) != VAL || lex(T) != INT) return syntax(T);
+    if (T->sc.val < 0 || T->sc.val > 127)
+        terror(T, "Value must be between 0 and 127");
+    T->data[1] = T->sc.val;
+    return 0;
 }
 
-static void splitval()
+static int splitval(struct track *T)
 {
-    if (yylex() != VAL || yylex() != INT) syntax();
-    if (yyval < 0 || yyval > 16383)
-        error("Value must be between 0 and 16383");
-    data[0] = yyval%128;
-    data[1] = yyval/128;
+    if (lex(T) != VAL || lex(T) != INT) return syntax(T);
+    if (T->sc.val < 0 || T->sc.val > 16383)
+        terror(T, "Value must be between 0 and 16383");
+    T->data[0] = T->sc.val%128;
+    T->data[1] = T->sc.val/128;
+    return 0;
 }
 
-static void get16val()
+static int get16val(struct track *T)
 {
-    if (yylex() != VAL || yylex() != INT) syntax();
-    if (yyval < 0 || yyval > 65535)
-        error("Value must be between 0 and 65535");
-    data[0] = (yyval>>8)&0xff;
-    data[1] = yyval&0xff;
+    if (lex(T) != VAL || lex(T) != INT) return syntax(T);
+    if (T->sc.val < 0 || T->sc.val > 65535)
+        terror(T, "Value must be between 0 and 65535");
+    T->data[0] = (T->sc.val>>8)&0xff;
+    T->data[1] = T->sc.val&0xff;
+    return 0;
 }
 
-static void checkcon()
+static int checkcon(struct track *T)
 {
-    if (yylex() != CON || yylex() != INT)
-        syntax();
-    if (yyval < 0 || yyval > 127)
-        error("Controller must be between 0 and 127");
-    data[0] = yyval;
+    if (lex(T) != CON || lex(T) != INT)
+        return syntax(T);
+    if (T->sc.val < 0 || T->sc.val > 127)
+        terror(T, "Controller must be between 0 and 127");
+    T->data[0] = T->sc.val;
+    return 0;
 }
 
-static void checkprog()
+static int checkprog(struct track *T)
 {
-    if (yylex() != PROG || yylex() != INT) syntax();
-    if (yyval < 0 || yyval > 127)
-        error("Program number must be between 0 and 127");
-    data[0] = yyval;
+    if (lex(T) != PROG || lex(T) != INT) return syntax(T);
+    if (T->sc.val < 0 || T->sc.val > 127)
+        terror(T, "Program number must be between 0 and 127");
+    T->data[0] = T->sc.val;
+    return 0;
 }
 
-static void checkeol()
+static int checkeol(struct track *T)
 {
-    if (eol_seen) return;
-    if (yylex() != EOL) {
-    	prs_error("Garbage deleted");
-        while (! eol_seen) yylex();	 /* skip rest of line */
-    }
+    if (T->sc.eol) return 0;
+    if (lex(T) != EOL)
+        return prs_error(T, "Garbage deleted");
+    return 0;
 }
 
-static void gethex()
+/* Read a string or hex sequence into the pool */
+static int gethex(struct track *T)
 {
-    int c;
-    buflen = 0;
-    do_hex = 1;
-    c = yylex();
+    int c, k;
+    char *text;
+    unsigned char *buffer;
+    long buflen, room, n;
+    T->sc.hex = 1;
+    c = lex(T);
     if (c == STRING) {
-        /* Note: yytext includes the trailing, but not the starting quote */
+        /* Note: text includes the trailing, but not the starting quote */
         int i = 0;
-    	if (yyleng-1 > bufsiz) {
-            bufsiz = yyleng-1;
-            if (buffer)
-                buffer = realloc(buffer, bufsiz);
-            else
-                buffer = malloc(bufsiz);
-            if (! buffer) error("Out of memory");
-        }
-        while (i < yyleng-1) {
-            c = yytext[i++];
+        int leng = T->sc.leng;
+        text = T->sc.text;
+        reserve(T, leng);
+        buffer = T->pool + T->poollen;
+        buflen = 0;
+        while (i < leng-1) {
+            c = text[i++];
 rescan:
             if (c == '\\') {
-                switch (c = yytext[i++]) {
+                switch (c = text[i++]) {
                     case '0':
                         c = '\0';
                         break;
@@ -267,39 +744,41 @@ rescan:
                         c = '\t';
                         break;
                     case 'x':
-                        if (sscanf(yytext+i, "%2x", &c) != 1)
-                            prs_error("Illegal \\x in string");
-                        i += 2;
+                        if ((k = hexbyte(text+i, leng-1-i, &c)) == 0)
+                            return prs_error(T, "Illegal \\x in string");
+                        i += k;
                         break;
                     case '\r':
                     case '\n':
-                        while ((c=yytext[i++]) == ' ' || c == '\t' ||
+                        while ((c=text[i++]) == ' ' || c == '\t' ||
                                 c == '\r' || c == '\n')
                             /* skip whitespace */;
                             goto rescan; /* sorry EWD :=) */
                 }
             }
             buffer[buflen++] = c;
-        }	    
+        }
+        T->poollen += buflen;
     } else if (c == INT) {
         do {
-    	    if (buflen >= bufsiz) {
-                bufsiz += 128;
-                if (buffer)
-                    buffer = realloc(buffer, bufsiz);
-                else
-                    buffer = malloc(bufsiz);
-                if (! buffer) error("Out of memory");
-            }
+            reserve(T, 1);
 /* This test not applicable for sysex
-            if (yyval < 0 || yyval > 127)
+            if (T->sc.val < 0 || T->sc.val > 127)
                 error("Illegal hex value"); */
-            buffer[buflen++] = yyval;
-            c = yylex();
+            T->pool[T->poollen++] = T->sc.val;
+            /* the rest of the run at once */
+            do {
+                reserve(T, 256);
+                room = T->poolsiz - T->poollen;
+                n = scanhex(&T->sc, T->pool + T->poollen, room);
+                T->poollen += n;
+            } while (n == room);
+            c = lex(T);
         } while (c == INT);
-        if (c != EOL) prs_error("Unknown hex input");
+        if (c != EOL) return prs_error(T, "Unknown hex input");
     }
-    else prs_error("String or hex input expected");
+    else return prs_error(T, "String or hex input expected");
+    return 0;
 }
 
 long bankno(char *s, int n)
@@ -319,217 +798,580 @@ long bankno(char *s, int n)
     return res;
 }
 
-static void mywritetrack()
+/* An event line, after its time; returns -1 after an error */
+static int parseevent(struct track *T, int secs)
 {
     int opcode, c;
-    long currtime = 0;
-    long newtime, delta;
-    int i, k;
- 
-    while ((opcode = yylex()) == EOL);
-    if (opcode != MTRK)
-        prs_error("Missing MTrk");
-    checkeol();
-    while (1) {
-        err_cont = 1;
-        setjmp(erjump);
-        switch (yylex()) {
-            case MTRK:
-                prs_error("Unexpected MTrk");
-            case EOF:
-                err_cont = 0;
-                error("Unexpected EOF");
-                return;
-            case TRKEND:
-                err_cont = 0;
-                checkeol();
-                return;
-            case INT:
-                newtime = yyval;
-                if ((opcode=yylex())=='/') {
-                    if (yylex()!=INT) prs_error("Illegal time value");
-                    newtime = (newtime-M0)*Measure+yyval;
-                    if (yylex() != '/' || yylex() != INT)
-                        prs_error("Illegal time value");
-                    newtime = T0 + newtime*Beat + yyval;
-                    opcode = yylex();
-                }
-                delta = newtime - currtime;
-                switch (opcode) {
-                    case ON:
-                    case OFF:
-                    case POPR:
-                        checkchan();
-                        checknote();
-                        checkval();
-                        mf_w_midi_event(delta, opcode, chan,
-                                (unsigned char *)data, 2L);
-                        break;
+    long newtime, off;
+    long long usec = T->sc.usec;
+    int i, k, nev = T->nev;
 
-                    case PAR:
-                        checkchan();
-                        checkcon();
-                        checkval();
-                        mf_w_midi_event(delta, opcode, chan,
-                                (unsigned char *)data, 2L);
-                        break;
-		
-                    case PB:
-                        checkchan();
-                        splitval();
-                        mf_w_midi_event(delta, opcode, chan,
-                                (unsigned char *)data, 2L);
-                        break;
+    newtime = secs ? 0 : T->sc.val;
+    if ((opcode=lex(T))=='/') {
+        long bar = newtime, beat;
+        if (secs) return prs_error(T, "Illegal time value");
+        if (lex(T)!=INT) return prs_error(T, "Illegal time value");
+        beat = T->sc.val;
+        if (lex(T) != '/' || lex(T) != INT)
+            return prs_error(T, "Illegal time value");
+        newtime = mt_ticks(&T->mt, bar, beat, T->sc.val);
+        T->mtused = 1;
+        opcode = lex(T);
+    }
+    switch (opcode) {
+        case ON:
+        case OFF:
+        case POPR:
+            if (checkchan(T) < 0 || checknote(T) < 0 || checkval(T) < 0)
+                return -1;
+            dataevent(T, newtime, EV_MIDI, opcode, 2L);
+            break;
 
-                    case PRCH:
-                        checkchan();
-                        checkprog();
-                        mf_w_midi_event(delta, opcode, chan,
-                                (unsigned char *)data, 1L);
-                        break;
- 
-                    case CHPR:
-                        checkchan();
-                        checkval();
-                        data[0] = data[1];
-                        mf_w_midi_event(delta, opcode, chan,
-                                (unsigned char *)data, 1L);
-                        break;
- 
-                    case SYSEX:
-                    case ARB:
-                        gethex();
-                        mf_w_sysex_event(delta, (unsigned char *)buffer,
-                                (long)buflen);
-                        break;
+        case PAR:
+            if (checkchan(T) < 0 || checkcon(T) < 0 || checkval(T) < 0)
+                return -1;
+            dataevent(T, newtime, EV_MIDI, opcode, 2L);
+            break;
 
-                    case TEMPO:
-                        if (yylex() != INT) syntax();
-                        mf_w_tempo(delta, yyval);
-                        break;
+        case PB:
+            if (checkchan(T) < 0 || splitval(T) < 0)
+                return -1;
+            dataevent(T, newtime, EV_MIDI, opcode, 2L);
+            break;
 
-                    case TIMESIG: {
-                        int nn, denom, cc, bb;
-                        if (yylex() != INT || yylex() != '/') syntax();
-                        nn = yyval;
-                        denom = getbyte("Denom");
-                        cc = getbyte("clocks per click");
-                        bb = getbyte("32nd notes per 24 clocks");
-                        for (i = 0, k = 1 ; k < denom; i++, k <<= 1);
-                        if (k != denom) error ("Illegal TimeSig");
-                        data[0] = nn;
-                        data[1] = i;
-                        data[2] = cc;
-                        data[3] = bb;
-                        M0 += (newtime-T0)/(Beat*Measure);
-                        T0 = newtime;
-                        Measure = nn;
-                        Beat = 4 * Clicks / denom;
-                        mf_w_meta_event(delta, time_signature,
-                                (unsigned char *)data, 4L);
-                        break;
-                    }
+        case PRCH:
+            if (checkchan(T) < 0 || checkprog(T) < 0)
+                return -1;
+            dataevent(T, newtime, EV_MIDI, opcode, 1L);
+            break;
 
-                    case SMPTE:
-                        for (i=0; i<5; i++)
-                            data[i] = getbyte("SMPTE");
-                        mf_w_meta_event(delta, smpte_offset,
-                                (unsigned char *)data, 5L);
-                        break;
+        case CHPR:
+            if (checkchan(T) < 0 || checkval(T) < 0)
+                return -1;
+            T->data[0] = T->data[1];
+            dataevent(T, newtime, EV_MIDI, opcode, 1L);
+            break;
 
-                    case KEYSIG:
-                        data[0] = i = getint ("Keysig");
-                        if (i < -7 || i > 7)
-                            error ("Key Sig must be between -7 and 7");
-                        if ((c=yylex()) != MINOR && c != MAJOR)
-                            syntax();
-                        data[1] = (c == MINOR);
-                        mf_w_meta_event(delta, key_signature,
-                                (unsigned char *)data, 2L);
-                        break;
+        case SYSEX:
+        case ARB:
+            off = T->poollen;
+            if (gethex(T) < 0)
+                return -1;
+            addevent(T, newtime, EV_SYSEX, 0, off);
+            break;
 
-                    case SEQNR:
-                        get16val ("SeqNr");
-                        mf_w_meta_event(delta, sequence_number,
-                                (unsigned char *)data, 2L);
-                        break;
+        case TEMPO:
+            if (lex(T) != INT) return syntax(T);
+            addevent(T, newtime, EV_TEMPO, 0, T->poollen)->off = T->sc.val;
+            break;
 
-                    case META: {
-                        int type = yylex();
-                        switch (type) {
-                            case TRKEND:
-                                type = end_of_track;
-                                break;
-                            case TEXT:
-                            case COPYRIGHT:
-                            case SEQNAME:
-                            case INSTRNAME:
-                            case LYRIC:
-                            case MARKER:
-                            case CUE:
-                                type -= (META+1);
-                                break;
-                            case INT:
-                                type = yyval;
-                                break;
-                            default:
-                                prs_error("Illegal Meta type");
-                        }
-                        if (type == end_of_track)
-                            buflen = 0;
-                        else
-                            gethex();
-                        mf_w_meta_event(delta, type,
-                                (unsigned char *)buffer, (long)buflen);
-                        break;
-                    }
+        case TIMESIG: {
+            int nn, denom, cc, bb;
+            if (secs) return prs_error(T, "TimeSig needs a time in ticks");
+            if (lex(T) != INT || lex(T) != '/') return syntax(T);
+            nn = T->sc.val;
+            denom = getbyte(T, "Denom");
+            cc = getbyte(T, "clocks per click");
+            bb = getbyte(T, "32nd notes per 24 clocks");
+            for (i = 0, k = 1 ; k < denom; i++, k <<= 1);
+            if (k != denom) terror(T, "Illegal TimeSig");
+            T->data[0] = nn;
+            T->data[1] = i;
+            T->data[2] = cc;
+            T->data[3] = bb;
+            mt_timesig(&T->mt, newtime, nn, denom);
+            T->mtused = T->mtset = 1;
+            dataevent(T, newtime, EV_META, time_signature, 4L);
+            break;
+        }
 
-                    case SEQSPEC:
-                        gethex();
-                        mf_w_meta_event(delta, sequencer_specific,
-                                (unsigned char *)buffer, (long)buflen);
-                        break;
+        case SMPTE:
+            for (i=0; i<5; i++)
+                T->data[i] = getbyte(T, "SMPTE");
+            dataevent(T, newtime, EV_META, smpte_offset, 5L);
+            break;
 
-                    default:
-                        prs_error("Unknown input");
-                        break;
+        case KEYSIG:
+            T->data[0] = i = getint(T, "Keysig");
+            if (i < -7 || i > 7)
+                terror(T, "Key Sig must be between -7 and 7");
+            if ((c=lex(T)) != MINOR && c != MAJOR)
+                return syntax(T);
+            T->data[1] = (c == MINOR);
+            dataevent(T, newtime, EV_META, key_signature, 2L);
+            break;
+
+        case SEQNR:
+            if (get16val(T) < 0)
+                return -1;
+            dataevent(T, newtime, EV_META, sequence_number, 2L);
+            break;
+
+        case META: {
+            int type = lex(T);
+            switch (type) {
+                case TRKEND:
+                    type = end_of_track;
+                    break;
+                case TEXT:
+                case COPYRIGHT:
+                case SEQNAME:
+                case INSTRNAME:
+                case LYRIC:
+                case MARKER:
+                case CUE:
+                    type -= (META+1);
+                    break;
+                case INT:
+                    type = T->sc.val;
+                    break;
+                default:
+                    return prs_error(T, "Illegal Meta type");
+            }
+            off = T->poollen;
+            if (type != end_of_track && gethex(T) < 0)
+                return -1;
+            addevent(T, newtime, EV_META, type, off);
+            break;
+        }
+
+        case SEQSPEC:
+            off = T->poollen;
+            if (gethex(T) < 0)
+                return -1;
+            addevent(T, newtime, EV_META, sequencer_specific, off);
+            break;
+
+        default:
+            return prs_error(T, "Unknown input");
+    }
+    if (secs && T->nev > nev) {
+        if (T->nsec >= T->secsiz) {
+            T->secsiz = T->secsiz ? 2 * T->secsiz : 64;
+            T->sec = grow(T->sec, T->secsiz * sizeof(struct sectime));
+        }
+        T->sec[T->nsec].ev = nev;
+        T->sec[T->nsec++].usec = usec;
+    }
+    return 0;
+}
+
+/*
+ * Sort the events of T by time, keeping the order of the text for events
+ * at the same time.  Small tracks get an insertion sort, large ones a
+ * radix sort on the bytes of the time that are not the same in all
+ * events.  An End of Track must be the last event, so only the last one
+ * is kept and it is moved to the end.  The messages are then shown before
+ * the first event that comes after all the events they were found at.
+ */
+static void sortevents(struct track *T)
+{
+    struct event *a = T->ev, *b, *tmp, e;
+    long count[sizeof(unsigned long)][256];
+    long pos, sum;
+    int n = T->nev, i, j, k, d;
+
+    for (i = 1; i < n && a[i-1].time <= a[i].time; i++)
+        ;
+    if (i < n && n < 64) {
+        for (i = 1; i < n; i++) {
+            e = a[i];
+            for (j = i; j > 0 && a[j-1].time > e.time; j--)
+                a[j] = a[j-1];
+            a[j] = e;
+        }
+    } else if (i < n) {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++)
+            for (d = 0; d < (int)sizeof(unsigned long); d++)
+                count[d][(a[i].time >> (8 * d)) & 0xff]++;
+        b = grow(NULL, T->evsiz * sizeof(struct event));
+        for (d = 0; d < (int)sizeof(unsigned long); d++) {
+            if (count[d][(a[0].time >> (8 * d)) & 0xff] == n)
+                continue;	/* all the same */
+            for (sum = 0, k = 0; k < 256; k++) {
+                pos = count[d][k];
+                count[d][k] = sum;
+                sum += pos;
+            }
+            for (i = 0; i < n; i++)
+                b[count[d][(a[i].time >> (8 * d)) & 0xff]++] = a[i];
+            tmp = a; a = b; b = tmp;
+        }
+        free(b);
+        T->ev = a;
+    }
+    for (i = 0, j = 0, k = 0; i < n; i++)
+        if (a[i].kind == EV_META && a[i].type == end_of_track) {
+            e = a[i];
+            k = 1;
+        } else
+            a[j++] = a[i];
+    if (k) {
+        if (j > 0 && e.time < a[j-1].time)
+            e.time = a[j-1].time;
+        a[j++] = e;
+        T->nev = n = j;
+    }
+    for (pos = 0, i = 0; i < n; i++) {
+        if (a[i].msglen < pos)
+            a[i].msglen = pos;
+        pos = a[i].msglen;
+    }
+}
+
+/*
+ * Times in seconds are converted to ticks when all tracks have been
+ * parsed.  They use the tempo changes of the first track in a format 1
+ * file and those of the track itself otherwise.  The time of each tempo
+ * change is also kept in microseconds times the division (acc), so the
+ * conversion is exact integer math.
+ */
+struct tempo {
+    long time;
+    long tempo;
+    long long acc;
+    int ev;			/* the event it came from */
+};
+
+static struct tempo *Tmap;
+static int Ntmap, Tmapsiz;
+static struct sectime *Tsec;	/* tempo changes with a time in seconds */
+static int Tsecsiz;
+
+static void tempoinit(void)
+{
+    if (Tmapsiz == 0) {
+        Tmapsiz = 64;
+        Tmap = grow(NULL, Tmapsiz * sizeof(struct tempo));
+    }
+    Tmap[0].time = 0;
+    Tmap[0].tempo = 500000;
+    Tmap[0].acc = 0;
+    Tmap[0].ev = -1;
+    Ntmap = 1;
+}
+
+/* of two tempo changes at the same time the later event is kept */
+static void addtempo(long time, long tempo, int ev)
+{
+    int i;
+
+    if (tempo <= 0)
+        return;
+    for (i = Ntmap; i > 0 && Tmap[i-1].time > time; i--)
+        ;
+    if (i > 0 && Tmap[i-1].time == time) {
+        if (Tmap[--i].ev > ev)
+            return;
+        Tmap[i].tempo = tempo;
+        Tmap[i].ev = ev;
+    } else {
+        if (Ntmap >= Tmapsiz) {
+            Tmapsiz *= 2;
+            Tmap = grow(Tmap, Tmapsiz * sizeof(struct tempo));
+        }
+        memmove(&Tmap[i+1], &Tmap[i], (Ntmap - i) * sizeof(struct tempo));
+        Tmap[i].time = time;
+        Tmap[i].tempo = tempo;
+        Tmap[i].ev = ev;
+        Ntmap++;
+    }
+    for (i = i > 0 ? i : 1; i < Ntmap; i++)
+        Tmap[i].acc = Tmap[i-1].acc +
+                (long long)(Tmap[i].time - Tmap[i-1].time) * Tmap[i-1].tempo;
+}
+
+/* the tick nearest to usec; the search goes on from *cur */
+static long usectotick(long long usec, int *cur)
+{
+    long long target;
+    int i = *cur;
+
+    if (Clicks & 0x8000)	/* SMPTE: frames per second times ticks */
+        return (long)((usec * -(signed char)(Clicks >> 8) * (Clicks & 0xff)
+                + 500000) / 1000000);
+    target = usec * Clicks;
+    if (i >= Ntmap || Tmap[i].acc > target)
+        i = 0;
+    while (i + 1 < Ntmap && Tmap[i+1].acc <= target)
+        i++;
+    *cur = i;
+    return Tmap[i].time +
+            (long)((target - Tmap[i].acc + Tmap[i].tempo / 2) / Tmap[i].tempo);
+}
+
+static int seccmp(const void *a, const void *b)
+{
+    const struct sectime *x = a, *y = b;
+
+    if (x->usec != y->usec)
+        return x->usec < y->usec ? -1 : 1;
+    return x->ev - y->ev;
+}
+
+/*
+ * Convert the times of T.  If own, its tempo changes are added to the
+ * map first: those in ticks, then those in seconds from the earliest on,
+ * each converted with the changes before it.  So the result does not
+ * depend on the order of the lines.
+ */
+static void convertsecs(struct track *T, int own)
+{
+    struct event *e;
+    int i, k, n = 0, cur = 0;
+
+    for (i = 0, k = 0; own && i < T->nev; i++) {
+        e = &T->ev[i];
+        if (k < T->nsec && T->sec[k].ev == i) {
+            if (e->kind == EV_TEMPO) {
+                if (n >= Tsecsiz) {
+                    Tsecsiz = Tsecsiz ? 2 * Tsecsiz : 64;
+                    Tsec = grow(Tsec, Tsecsiz * sizeof(struct sectime));
                 }
-                currtime = newtime;
+                Tsec[n++] = T->sec[k];
+            }
+            k++;
+        } else if (e->kind == EV_TEMPO)
+            addtempo(e->time, e->off, i);
+    }
+    if (n > 1)
+        qsort(Tsec, n, sizeof(struct sectime), seccmp);
+    for (i = 0; i < n; i++) {
+        e = &T->ev[Tsec[i].ev];
+        e->time = usectotick(Tsec[i].usec, &cur);
+        addtempo(e->time, e->off, Tsec[i].ev);
+    }
+    for (k = 0; k < T->nsec; k++) {
+        e = &T->ev[T->sec[k].ev];
+        if (!own || e->kind != EV_TEMPO)
+            e->time = usectotick(T->sec[k].usec, &cur);
+    }
+    if (Sort && T->nsec > 0)
+        sortevents(T);
+}
+
+static void secstoticks(void)
+{
+    int t;
+
+    for (t = 0; t < Ntrks && Trk[t].nsec == 0; t++)
+        ;
+    if (t == Ntrks || Clicks <= 0)
+        return;
+    if (Format == 1) {
+        /* the tempo track must be parsed, not taken from the cache */
+        if (Trk[0].hit) {
+            Trk[0].hit = NULL;
+            parsetrack(&Trk[0]);
+        }
+        tempoinit();
+        convertsecs(&Trk[0], 1);
+        for (t = 1; t < Ntrks; t++)
+            if (Trk[t].nsec > 0)
+                convertsecs(&Trk[t], 0);
+    } else {
+        for (t = 0; t < Ntrks; t++)
+            if (Trk[t].nsec > 0) {
+                tempoinit();
+                convertsecs(&Trk[t], 1);
+            }
+    }
+}
+
+/*
+ * Parse one track from T->sc, starting with the time signature state in
+ * T->mtin.  Only T is used, so tracks can be parsed in parallel.
+ */
+void parsetrack(struct track *T)
+{
+    int opcode, r;
+
+    T->start = T->sc.p;
+    T->line = T->sc.line;
+    T->mt = T->mtin;
+    T->mtused = T->mtset = 0;
+    T->status = T_OK;
+    T->nev = 0;
+    T->poollen = 0;
+    T->msglen = 0;
+    T->nsec = 0;
+    T->chan = 0;
+
+    while ((opcode = lex(T)) == EOL);
+    if (opcode != MTRK)
+        prs_error(T, "Missing MTrk");
+    if (T->status == T_OK && checkeol(T) < 0)
+        skipline(T);
+    while (T->status == T_OK) {
+        switch (opcode = lex(T)) {
+            case MTRK:
+                r = prs_error(T, "Unexpected MTrk");
+                break;
+            case EOF:
+                terror(T, "Unexpected EOF");
+                T->status = T_EOF;
+                r = -1;
+                break;
+            case TRKEND:
+                if (checkeol(T) < 0)
+                    skipline(T);
+                goto done;
+            case INT:
+            case SECS:
+                r = parseevent(T, opcode == SECS);
+                break;
             case EOL:
+                r = 0;
                 break;
             default:
-                prs_error("Unknown input");
+                r = prs_error(T, "Unknown input");
+                break;
+        }
+        /* after an error the line has been skipped already */
+        if (r == 0)
+            checkeol(T);
+    }
+done:
+    T->end = T->sc.p;
+    T->endline = T->sc.line;
+    if (Sort && T->nsec == 0)
+        sortevents(T);
+}
+
+/* Mf_wtrack: write the events of the next track */
+static void writetrack(void)
+{
+    struct track *T = &Trk[TrkNr++];
+    struct event *e, *last;
+    unsigned long delta, time = 0, eotdelta = 0;
+    long m = 0, size = -1;
+
+    if (T->hit) {
+        mf_w_bytes(T->hit->data, T->hit->size);
+        if (T->hit->eot)
+            mf_w_meta_event(T->hit->eotdelta, end_of_track, NULL, 0);
+        return;
+    }
+    last = T->nev > 0 ? &T->ev[T->nev-1] : NULL;
+    Caplen = 0;
+    Capture = 1;
+    for (e = T->ev; e < T->ev + T->nev; e++) {
+        showmsg(T, m, e->msglen);
+        m = e->msglen;
+        delta = e->time - time;
+        time = e->time;
+        /*
+         * The library adds no End of Track after an explicit one, so the
+         * cache keeps that apart and it is written again with the track.
+         */
+        if (e == last && e->kind == EV_META && e->type == end_of_track) {
+            size = Caplen;
+            eotdelta = delta;
+        }
+        switch (e->kind) {
+            case EV_MIDI:
+                mf_w_midi_event(delta, e->type, e->chan,
+                        T->pool + e->off, e->len);
+                break;
+            case EV_SYSEX:
+                mf_w_sysex_event(delta, T->pool + e->off, e->len);
+                break;
+            case EV_META:
+                mf_w_meta_event(delta, e->type,
+                        T->pool + e->off, e->len);
+                break;
+            case EV_TEMPO:
+                mf_w_tempo(delta, e->off);
                 break;
         }
-        checkeol();
     }
+    Capture = 0;
+    showmsg(T, m, T->msglen);
+    if (T->status == T_FATAL)
+        exit(1);
+    if (Cachefile && !Tokens && T->status == T_OK && T->msglen == 0 &&
+            T->nsec == 0 && (size < 0 || last->len == 0))
+        cacheadd(T, cacheopts(), Cap, size < 0 ? Caplen : size,
+                size >= 0, eotdelta);
 }
 
 static void initfuncs(void)
 {
-    Mf_putc = putchar;
-    Mf_wtrack = mywritetrack;
+    Mf_putc = Cachefile ? cacheputc : outputc;
+    Mf_wtrack = writetrack;
+}
+
+/* A -m pattern has one %d, maybe with a width, and no other conversion */
+static int goodpattern(char *s)
+{
+    int n = 0;
+
+    for (; *s; s++) {
+        if (*s != '%')
+            continue;
+        if (*++s == '%')
+            continue;
+        while (isdigit((unsigned char)*s))
+            s++;
+        if (*s != 'd')
+            return 0;
+        n++;
+    }
+    return n == 1;
 }
 
 static void usage(void)
 {
     fprintf(stderr,
 "t2mf v%s\n"
-"Usage: t2mf [-r] [textfile [midifile]]\n\n"
+"Usage: t2mf [-rs] [-j n] [-C cachefile] [textfile [midifile]]\n"
+"       t2mf -m pat [-rs] [-j n] [-C cachefile] [textfile]\n"
+"       t2mf -c [-m pat] [-j n] [textfile...]\n\n"
 "Options:\n"
-"  -r      use running status\n", VERSION);
+"  -r      use running status\n"
+"  -s      sort the events of each track by time\n"
+"  -j n    parse the tracks with n threads (default: one per processor)\n"
+"  -C file keep the encoded tracks in file and take the tracks that\n"
+"          have not changed from it\n"
+"  -m pat  the text holds many MFiles; write each to the file named\n"
+"          by pat with %%d replaced by its number, or to the file\n"
+"          named after it: MFile 1 2 96 \"name.mid\"\n"
+"  -c      only check the textfiles and report all errors\n"
+"A textfile may also hold the binary tokens of mf2t -T.\n",
+VERSION);
     exit(1);
 }
 
 int main(int argc, char **argv)
 {
-    int c;
+    int c, checkonly = 0, errors;
+    FILE *fp;
 
-    while ((c = getopt(argc, argv, "rh")) != -1) {
+    while ((c = getopt(argc, argv, "rsj:C:m:ch")) != -1) {
         switch (c) {
             case 'r':
                 Mf_RunStat = 1;
                 break;
+            case 's':
+                Sort = 1;
+                break;
+            case 'C':
+                Cachefile = optarg;
+                break;
+            case 'm':
+                Outpattern = optarg;
+                if (!goodpattern(Outpattern))
+                    usage();
+                break;
+            case 'c':
+                checkonly = 1;
+                break;
+            case 'j':
+                Nthreads = atoi(optarg);
+                if (Nthreads < 1)
+                    usage();
+                break;
             case 'h':
             case '?':
             default:
@@ -537,13 +1379,37 @@ int main(int argc, char **argv)
         }
     }
 
-    if (optind < argc && !freopen(argv[optind++], "r", stdin)) {
+    if (Nthreads == 0)
+        Nthreads = ncpus();
+
+#ifdef _WIN32
+    /* the text may also be a token file; the scanner skips \r */
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    if (checkonly) {
+        if (optind == argc)
+            return check(stdin, "-");
+        for (errors = 0; optind < argc; optind++) {
+            if ((fp = fopen(argv[optind], "rb")) == NULL) {
+                fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+                errors = 1;
+                continue;
+            }
+            errors |= check(fp, argv[optind]);
+            fclose(fp);
+        }
+        return errors;
+    }
+
+    if (optind < argc && !freopen(argv[optind++], "rb", stdin)) {
         fprintf(stderr, "freopen (%s): %s\n", argv[optind - 1],
                 strerror(errno));
         exit(1);
     }
-    yyin = stdin;
 
+    if (Outpattern && optind < argc)
+        usage();
     if (optind < argc && !freopen(argv[optind], "w", stdout)) {
         fprintf(stderr, "freopen (%s): %s\n", argv[optind],
                 strerror(errno));
@@ -552,11 +1418,6 @@ int main(int argc, char **argv)
 
     initfuncs();
     TrkNr = 0;
-    Measure = 4;
-    Beat = 96;
-    Clicks = 96;
-    M0 = 0;
-    T0 = 0;
     translate();
 
     return 0;
@@ -2,7 +2,9 @@
 #define T2MF_H
 
 /* $Id: t2mf.h,v 1.2 1991/11/03 21:50:50 piet Rel $ */
+#include <stdio.h>
 #include "midifile.h"
+#include "mtime.h"
 
 #define MTHD	256
 #define MTRK	257
@@ -49,4 +51,118 @@
 #define TIMESIG	(META+1+time_signature)
 #define SMPTE	(META+1+smpte_offset)
 
+#define SECS	(SEQSPEC+1)	/* a time in seconds or milliseconds */
+
+/* t2mfscan.c */
+struct scanner {
+    char *p, *end;	/* the rest of the input */
+    int state;
+    int hex;		/* switch to hex mode at the next token */
+    int eol;		/* the last token was EOL */
+    int line;
+    char *bol;		/* the start of the line */
+    char *text;		/* the last token (not NUL terminated) */
+    int leng;
+    int tline, tcol;	/* and where it starts */
+    long val;		/* its value if it is an INT */
+    long long usec;	/* and in microseconds if it is SECS */
+    char *msg;		/* an error found by the scanner, or NULL */
+};
+
+extern char *readinput(FILE *fp, long *len);
+extern void scaninit(struct scanner *s, char *buf, long len);
+extern int scan(struct scanner *s);
+extern int hexbyte(char *p, int n, int *val);
+extern long scanhex(struct scanner *s, unsigned char *out, long max);
+
+/* t2mf.c */
+#define EV_MIDI		0
+#define EV_SYSEX	1
+#define EV_META		2
+#define EV_TEMPO	3
+
+/* a parsed event, written with the mf_w_ function of its kind */
+struct event {
+    unsigned long time;	/* absolute, in ticks */
+    int kind;
+    int type, chan;
+    long off, len;	/* the data in the pool of the track; off is the
+			   tempo of EV_TEMPO */
+    long msglen;	/* the messages of the track up to this event */
+};
+
+/* an event with its time in seconds, converted after parsing */
+struct sectime {
+    int ev;		/* the index of the event */
+    long long usec;
+};
+
+#define T_OK	0
+#define T_EOF	1	/* EOF before TrkEnd */
+#define T_FATAL	2	/* t2mf has to stop after this track */
+
+/* a track in the cache (t2mfcache.c) */
+struct centry {
+    unsigned long long h[2];	/* the hash of its text and the options */
+    long textlen;
+    int mtused, mtset;
+    struct mtime mtin, mt;	/* as in struct track */
+    long size;		/* the encoded track, without End of Track */
+    unsigned char *data;
+    int eot;		/* it ends with an explicit End of Track */
+    unsigned long eotdelta;
+    int used;		/* used or added in this run */
+};
+
+struct track {
+    struct scanner sc;
+    char *start, *end;	/* the text that was parsed */
+    int line, endline;
+    struct mtime mtin;	/* the time signature state before the track */
+    struct mtime mt;	/* and after it */
+    int mtused;		/* the events depend on mtin */
+    int mtset;		/* the track has a TimeSig */
+    int status;
+
+    struct event *ev;
+    int nev, evsiz;
+    unsigned char *pool;
+    long poollen, poolsiz;
+    char *msg;		/* the error messages */
+    long msglen, msgsiz;
+    struct sectime *sec;
+    int nsec, secsiz;
+
+    unsigned char data[5];
+    int chan;
+    struct centry *hit;	/* the track is taken from the cache */
+};
+
+extern void error(char *s);
+extern void *grow(void *p, long size);
+extern void tokerror(struct track *T, long off, char *s);
+extern void reserve(struct track *T, long n);
+extern struct event *addevent(struct track *T, unsigned long time,
+        int kind, int type, long off);
+extern long bankno(char *s, int n);
+extern void parsetrack(struct track *T);
+
+/* t2mfpar.c */
+extern int ncpus(void);
+extern int splittracks(char *p, char *end, int line, struct track *tv, int n);
+extern void parsetracks(struct track **tv, int n, int nthreads);
+
+/* t2mfcache.c */
+extern void cacheload(char *name);
+extern struct centry *cachefind(char *text, long len, int opts);
+extern void cacheadd(struct track *T, int opts, unsigned char *data,
+        long size, int eot, unsigned long eotdelta);
+extern int cachesave(char *name);
+
+/* t2mftok.c */
+extern int istokens(char *buf, long len);
+extern int tokheader(struct track *T, int *format, int *ntrks,
+        int *division);
+extern void toktrack(struct track *T);
+
 #endif
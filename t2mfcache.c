@@ -0,0 +1,194 @@
+/*
+ * t2mfcache
+ *
+ * The track cache of t2mf (-C file).  The file holds, for each track
+ * that was written without errors, a hash of its text and the bytes it
+ * was encoded to.  A track whose text is found in the cache is copied
+ * from it instead of being parsed and encoded again.  Tracks that depend
+ * on the time signature state are only taken from the cache when that
+ * state is the same as when they were encoded.
+ *
+ * The file is written in the byte order and layout of the machine, and
+ * is thrown away when it does not fit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "t2mf.h"
+
+#define MAGIC	"t2mf cache 1\n"
+
+static struct centry **Ent;	/* the ones read are sorted by hash */
+static long Nent, Entsiz, Nsorted;
+
+static unsigned long long rotl(unsigned long long x, int n)
+{
+    return x << n | x >> (64 - n);
+}
+
+static unsigned long long fmix(unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* a 128 bit hash of the text and the options, eight bytes at a time */
+static void hash(char *p, long len, int opts, unsigned long long h[2])
+{
+    unsigned long long h1 = 0x9368e53c2f6af274ULL, h2 = 0x586dcd208f7cd3fdULL;
+    unsigned long long w;
+    long i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        h1 = rotl((h1 ^ w) * 0x87c37b91114253d5ULL, 31);
+        h2 = (h2 + w) * 0x4cf5ad432745937fULL;
+        h2 ^= h2 >> 32;
+    }
+    w = 0;
+    memcpy(&w, p + i, len - i);
+    h1 = rotl((h1 ^ w) * 0x87c37b91114253d5ULL, 31);
+    h2 = (h2 + w) * 0x4cf5ad432745937fULL;
+    h1 ^= (unsigned long long)len;
+    h2 ^= (unsigned long long)opts;
+    h1 += h2;
+    h2 += h1;
+    h[0] = fmix(h1);
+    h[1] = fmix(h2 ^ h[0]);
+}
+
+static int compare(const void *a, const void *b)
+{
+    const struct centry *x = *(struct centry **)a, *y = *(struct centry **)b;
+
+    if (x->h[0] != y->h[0])
+        return x->h[0] < y->h[0] ? -1 : 1;
+    if (x->h[1] != y->h[1])
+        return x->h[1] < y->h[1] ? -1 : 1;
+    return 0;
+}
+
+/* entries do not move, tracks point to them */
+static struct centry *newentry(void)
+{
+    struct centry *e = grow(NULL, sizeof(struct centry));
+
+    if (Nent >= Entsiz) {
+        Entsiz = Entsiz ? 2 * Entsiz : 64;
+        Ent = grow(Ent, Entsiz * sizeof(struct centry *));
+    }
+    memset(e, 0, sizeof(struct centry));
+    return Ent[Nent++] = e;
+}
+
+/*
+ * Read the cache file; a missing or bad one gives an empty cache.  errno
+ * is left alone, the library reports it with its own errors.
+ */
+void cacheload(char *name)
+{
+    FILE *fp;
+    char magic[sizeof(MAGIC)];
+    long entsize;
+    struct centry *e;
+    int olderrno = errno;
+
+    fp = fopen(name, "rb");
+    errno = olderrno;
+    if (fp == NULL)
+        return;
+    if (fread(magic, 1, sizeof(MAGIC), fp) != sizeof(MAGIC) ||
+            memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            fread(&entsize, sizeof(long), 1, fp) != 1 ||
+            entsize != sizeof(struct centry)) {
+        fclose(fp);
+        return;
+    }
+    for (;;) {
+        e = newentry();
+        if (fread(e, sizeof(struct centry), 1, fp) != 1 || e->size < 0) {
+            free(Ent[--Nent]);
+            break;
+        }
+        e->data = grow(NULL, e->size + 1);
+        if (fread(e->data, 1, e->size, fp) != (size_t)e->size) {
+            free(e->data);
+            free(Ent[--Nent]);
+            break;
+        }
+        e->used = 0;
+    }
+    fclose(fp);
+    qsort(Ent, Nent, sizeof(struct centry *), compare);
+    Nsorted = Nent;
+}
+
+/* The entry for the text of a track, or NULL. */
+struct centry *cachefind(char *text, long len, int opts)
+{
+    struct centry key, *k = &key, **e;
+
+    if (Nsorted == 0)
+        return NULL;
+    hash(text, len, opts, key.h);
+    e = bsearch(&k, Ent, Nsorted, sizeof(struct centry *), compare);
+    if (e == NULL || (*e)->textlen != len)
+        return NULL;
+    return *e;
+}
+
+/*
+ * Add the track T that was encoded to size bytes from data, followed by
+ * an End of Track event if eot is set.
+ */
+void cacheadd(struct track *T, int opts, unsigned char *data, long size,
+        int eot, unsigned long eotdelta)
+{
+    struct centry *e = newentry();
+
+    hash(T->start, T->end - T->start, opts, e->h);
+    e->textlen = T->end - T->start;
+    e->mtused = T->mtused;
+    e->mtset = T->mtset;
+    e->mtin = T->mtin;
+    e->mt = T->mt;
+    e->size = size;
+    e->data = grow(NULL, size + 1);
+    memcpy(e->data, data, size);
+    e->eot = eot;
+    e->eotdelta = eotdelta;
+    e->used = 1;
+}
+
+/*
+ * Write the entries that were used or added, so that the cache holds
+ * the tracks of the last file.  Returns -1 when it cannot be written.
+ */
+int cachesave(char *name)
+{
+    FILE *fp;
+    long entsize = sizeof(struct centry), i;
+    int r = 0;
+
+    if ((fp = fopen(name, "wb")) == NULL)
+        return -1;
+    fwrite(MAGIC, 1, sizeof(MAGIC), fp);
+    fwrite(&entsize, sizeof(long), 1, fp);
+    for (i = 0; i < Nent; i++) {
+        if (!Ent[i]->used)
+            continue;
+        fwrite(Ent[i], sizeof(struct centry), 1, fp);
+        fwrite(Ent[i]->data, 1, Ent[i]->size, fp);
+    }
+    if (ferror(fp))
+        r = -1;
+    if (fclose(fp) != 0)
+        r = -1;
+    return r;
+}
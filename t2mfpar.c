@@ -0,0 +1,174 @@
+/*
+ * t2mfpar
+ *
+ * Parallel parsing of the tracks of t2mf.  The text after the header is
+ * split after each line that starts with TrkEnd, and the pieces are
+ * parsed by a number of threads, each with its own scanner.  This is
+ * only a guess at where the tracks are: translate() checks every piece
+ * against the position of the serial parse and parses it again when it
+ * does not fit.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "t2mf.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MAXTHREADS	64
+
+static struct track **Work;
+static int Nwork, Next;
+
+#ifdef _WIN32
+static CRITICAL_SECTION Lock;
+#else
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int ncpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+#endif
+}
+
+/* Is p the start of the word TrkEnd? */
+static int istrkend(char *p, char *end)
+{
+    static char word[] = "trkend";
+    int i;
+
+    if (end - p < 6)
+        return 0;
+    for (i = 0; i < 6; i++)
+        if ((p[i] | 0x20) != word[i])
+            return 0;
+    return p + 6 == end || ((p[6] | 0x20) < 'a' || (p[6] | 0x20) > 'z');
+}
+
+/*
+ * Split the text from p into at most n tracks, starting at line `line'.
+ * Sets up the scanner of each of them and returns their number.
+ */
+int splittracks(char *p, char *end, int line, struct track *tv, int n)
+{
+    char *start, *q, *s;
+    int t, l;
+
+    for (t = 0; t < n && p < end; t++) {
+        start = p;
+        l = line;
+        for (;;) {
+            q = memchr(p, '\n', end - p);
+            for (s = p; s < end && (*s == ' ' || *s == '\t' || *s == '\r');
+                    s++)
+                ;
+            if (q == NULL) {
+                p = end;
+                break;
+            }
+            p = q + 1;
+            line++;
+            if (istrkend(s, q))
+                break;
+        }
+        scaninit(&tv[t].sc, start, p - start);
+        tv[t].sc.line = l;
+        tv[t].endline = line;
+    }
+    return t;
+}
+
+static struct track *getwork(void)
+{
+    struct track *T = NULL;
+
+#ifdef _WIN32
+    EnterCriticalSection(&Lock);
+#else
+    pthread_mutex_lock(&Lock);
+#endif
+    if (Next < Nwork)
+        T = Work[Next++];
+#ifdef _WIN32
+    LeaveCriticalSection(&Lock);
+#else
+    pthread_mutex_unlock(&Lock);
+#endif
+    return T;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall worker(void *arg)
+#else
+static void *worker(void *arg)
+#endif
+{
+    struct track *T;
+
+    while ((T = getwork()) != NULL)
+        parsetrack(T);
+    return 0;
+}
+
+/*
+ * Parse the n tracks in tv with nthreads threads, the calling one
+ * included.  When a thread cannot be started the others do its work.
+ */
+void parsetracks(struct track **tv, int n, int nthreads)
+{
+#ifdef _WIN32
+    static int init = 0;
+    HANDLE th[MAXTHREADS];
+#else
+    pthread_t th[MAXTHREADS];
+#endif
+    int i, k;
+
+    Work = tv;
+    Nwork = n;
+    Next = 0;
+    if (nthreads > n)
+        nthreads = n;
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+#ifdef _WIN32
+    if (!init) {
+        InitializeCriticalSection(&Lock);
+        init = 1;
+    }
+#endif
+    for (k = 0, i = 1; i < nthreads; i++) {
+#ifdef _WIN32
+        th[k] = (HANDLE)_beginthreadex(NULL, 0, worker, NULL, 0, NULL);
+        if (th[k] != 0)
+            k++;
+#else
+        if (pthread_create(&th[k], NULL, worker, NULL) == 0)
+            k++;
+#endif
+    }
+    worker(NULL);
+    for (i = 0; i < k; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(th[i], INFINITE);
+        CloseHandle(th[i]);
+#else
+        pthread_join(th[i], NULL);
+#endif
+    }
+}
@@ -0,0 +1,602 @@
+/*
+ * t2mfscan
+ *
+ * The scanner of t2mf.  The whole input is read into memory and the
+ * tokens are returned as pointers into it, so nothing is copied.  The
+ * tokens are (case is not significant):
+ *
+ *	MFile MTrk TrkEnd On Off PoPr PolyPr Par Param Pb PrCh ProgCh
+ *	ChPr ChanPr SysEx Meta SeqSpec Text Copyright TrkName SeqName
+ *	InstrName Lyric Marker Cue SeqNr KeySig Tempo TimeSig SMPTE Arb
+ *	minor major
+ *	ch= n= note= v= vol= val= c= con= p= prog=
+ *	: and /			as '/'
+ *	[-+]?[0-9]+		INT (ERR if it does not fit in a long)
+ *	0x[0-9a-f]+		INT (idem)
+ *	[0-9]+(\.[0-9]{1,6})?m?s	SECS, a time in seconds or milliseconds;
+ *				s->usec is the time in microseconds
+ *	$[a-h1-8]+		INT, a bank number (see bankno())
+ *	[a-g][#b+-]?[0-9]+	NOTEVAL
+ *	"..."			STRING, yytext is the text after the opening
+ *				quote up to and including the closing one
+ *	newline			EOL
+ *	[a-z]+ and any other character are ERR.
+ *
+ * A word that is longer than a keyword is not that keyword ("Online" is
+ * ERR), just like with the longest match of lex.  Spaces, tabs, CR, a #
+ * comment up to the end of the line (including the newline) and a
+ * backslash at the end of a line are skipped.  Errors in strings are left
+ * in s->msg for the parser.
+ *
+ * After gethex() sets s->hex the scanner is in hex mode up to the end of
+ * the line: then [0-9a-f][0-9a-f]? is an INT in hex and only strings,
+ * comments and continuation lines are recognized besides.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "t2mf.h"
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <tmmintrin.h>
+#define USE_SSSE3
+#elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+#define S_INITIAL	0
+#define S_HEX		1
+
+#define bankchar(c)	((((c)|0x20) >= 'a' && ((c)|0x20) <= 'h') || \
+                        ((c) >= '1' && (c) <= '8'))
+
+/* character classes */
+#define C_LETTER	1
+#define C_DIGIT		2
+#define C_HEX		4
+
+static unsigned char Class[256];
+static signed char Hexval[256];
+
+static struct keyword {
+    char *name;		/* in lower case */
+    int len;
+    int token;
+} Keywords[] = {
+    { "mfile", 5, MTHD },
+    { "mtrk", 4, MTRK },
+    { "trkend", 6, TRKEND },
+    { "on", 2, ON },
+    { "off", 3, OFF },
+    { "popr", 4, POPR },
+    { "polypr", 6, POPR },
+    { "par", 3, PAR },
+    { "param", 5, PAR },
+    { "pb", 2, PB },
+    { "prch", 4, PRCH },
+    { "progch", 6, PRCH },
+    { "chpr", 4, CHPR },
+    { "chanpr", 6, CHPR },
+    { "sysex", 5, SYSEX },
+    { "meta", 4, META },
+    { "seqspec", 7, SEQSPEC },
+    { "text", 4, TEXT },
+    { "copyright", 9, COPYRIGHT },
+    { "trkname", 7, SEQNAME },
+    { "seqname", 7, SEQNAME },
+    { "instrname", 9, INSTRNAME },
+    { "lyric", 5, LYRIC },
+    { "marker", 6, MARKER },
+    { "cue", 3, CUE },
+    { "seqnr", 5, SEQNR },
+    { "keysig", 6, KEYSIG },
+    { "tempo", 5, TEMPO },
+    { "timesig", 7, TIMESIG },
+    { "smpte", 5, SMPTE },
+    { "arb", 3, ARB },
+    { "minor", 5, MINOR },
+    { "major", 5, MAJOR },
+    { NULL, 0, 0 }
+};
+
+/* the keywords that end in = (without it) */
+static struct keyword Prefixes[] = {
+    { "ch", 2, CH },
+    { "n", 1, NOTE },
+    { "note", 4, NOTE },
+    { "v", 1, VAL },
+    { "vol", 3, VAL },
+    { "val", 3, VAL },
+    { "c", 1, CON },
+    { "con", 3, CON },
+    { "p", 1, PROG },
+    { "prog", 4, PROG },
+    { NULL, 0, 0 }
+};
+
+static void initclasses(void)
+{
+    int c;
+
+    for (c = 0; c < 256; c++)
+        Hexval[c] = -1;
+    for (c = 'a'; c <= 'z'; c++)
+        Class[c] = Class[c - 'a' + 'A'] = C_LETTER;
+    for (c = '0'; c <= '9'; c++) {
+        Class[c] = C_DIGIT | C_HEX;
+        Hexval[c] = c - '0';
+    }
+    for (c = 'a'; c <= 'f'; c++) {
+        Class[c] |= C_HEX;
+        Class[c - 'a' + 'A'] |= C_HEX;
+        Hexval[c] = Hexval[c - 'a' + 'A'] = c - 'a' + 10;
+    }
+}
+
+static int lookup(struct keyword *k, char *s, int len)
+{
+    int i;
+
+    for (; k->name; k++) {
+        if (k->len != len)
+            continue;
+        for (i = 0; i < len; i++)
+            if ((s[i] | 0x20) != k->name[i])
+                break;
+        if (i == len)
+            return k->token;
+    }
+    return 0;
+}
+
+/*
+ * Read all of fp into memory.  The buffer has a NUL after the end of the
+ * input, but the scanner does not rely on it.
+ */
+char *readinput(FILE *fp, long *len)
+{
+    char *buf = NULL;
+    long size = 0, n = 0, k;
+
+    do {
+        if (size - n < 65536) {
+            size = size ? 2 * size : 65536;
+            buf = realloc(buf, size + 1);
+            if (buf == NULL) {
+                error("Out of memory");
+                exit(1);
+            }
+        }
+        k = fread(buf + n, 1, size - n, fp);
+        n += k;
+    } while (k > 0);
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+/*
+ * The decoders of the numbers.  They take the whole run of digits, like
+ * the lex rules did, and return the number of characters used, or -n
+ * when the n characters of the number do not fit in a long.
+ */
+static int decimal(char *p, char *end, long *val)
+{
+    char *q = p;
+    unsigned long v = 0, max = LONG_MAX;
+    int neg = 0, over = 0, d;
+
+    if (*q == '-' || *q == '+') {
+        neg = (*q == '-');
+        if (neg)
+            max = (unsigned long)LONG_MAX + 1;
+        q++;
+    }
+    for (; q < end && (d = (unsigned char)*q - '0') >= 0 && d <= 9; q++) {
+        if (v > (max - d) / 10)
+            over = 1;
+        else
+            v = v * 10 + d;
+    }
+    if (over)
+        return -(q - p);
+    *val = neg ? (long)(0 - v) : (long)v;
+    return q - p;
+}
+
+/*
+ * A time in seconds or milliseconds: the n digits at p, which are in
+ * s->val, followed by an optional fraction of one to six digits and s or
+ * ms.  Returns the length of the token, 0 if it is not one, or minus the
+ * length if it is wrong.
+ */
+static int seconds(struct scanner *s, char *p, int n, char *end)
+{
+    char *q = p + n;
+    long long frac = 0, scale = 1000000, unit;
+    int d, digits = -1;
+
+    if (q < end && *q == '.')
+        for (q++, digits = 0;
+                q < end && (d = (unsigned char)*q - '0') >= 0 && d <= 9;
+                q++, digits++)
+            if (scale > 1) {
+                scale /= 10;
+                frac += d * scale;
+            }
+    if (q < end && (*q | 0x20) == 's') {
+        unit = 1000000;
+        q++;
+    } else if (q + 1 < end && (*q | 0x20) == 'm' && (q[1] | 0x20) == 's') {
+        unit = 1000;
+        q += 2;
+    } else
+        return p[n] == '.' ? -(q - p) : 0;
+    if (q < end && (Class[(unsigned char)*q] & (C_LETTER | C_DIGIT)))
+        return 0;
+    if (digits == 0 || digits > 6 || s->val > LLONG_MAX / unit - 1)
+        return -(q - p);
+    s->usec = s->val * unit + frac * unit / 1000000;
+    return q - p;
+}
+
+static int hexadecimal(char *p, char *end, long *val)
+{
+    char *q = p;
+    unsigned long v = 0;
+    int over = 0, d;
+
+    for (; q < end && (d = Hexval[(unsigned char)*q]) >= 0; q++) {
+        if (v > ((unsigned long)LONG_MAX - d) / 16)
+            over = 1;
+        else
+            v = v * 16 + d;
+    }
+    if (over)
+        return -(q - p);
+    *val = v;
+    return q - p;
+}
+
+/*
+ * The byte of a \x escape: up to two hex digits of the n characters at p.
+ * Returns the number of digits, 0 if there are none.
+ */
+int hexbyte(char *p, int n, int *val)
+{
+    int d, k = 0;
+
+    *val = 0;
+    while (k < 2 && k < n && (d = Hexval[(unsigned char)p[k]]) >= 0) {
+        *val = *val * 16 + d;
+        k++;
+    }
+    return k;
+}
+
+void scaninit(struct scanner *s, char *buf, long len)
+{
+    if (Class['a'] == 0)
+        initclasses();
+    s->p = buf;
+    s->end = buf + len;
+    s->state = S_INITIAL;
+    s->hex = 0;
+    s->eol = 0;
+    s->line = 1;
+    s->text = s->bol = buf;
+    s->tline = s->tcol = 1;
+    s->leng = 0;
+    s->val = 0;
+    s->msg = NULL;
+}
+
+/* a string; p is just after the opening quote */
+static int string(struct scanner *s, char *p)
+{
+    char *end = s->end;
+
+    s->text = p;
+    s->tline = s->line;
+    s->tcol = p - s->bol;
+    for (;;) {
+        if (p >= end) {
+            s->leng = p - s->text;
+            s->p = p;
+            s->msg = "EOF in string";
+            return EOF;
+        }
+        switch (*p++) {
+            case '"':
+                s->leng = p - s->text;
+                s->p = p;
+                s->state = S_INITIAL;
+                return STRING;
+            case '\\':
+                if (p < end) {
+                    if (*p == '\n') {
+                        s->line++;
+                        s->bol = p + 1;
+                    }
+                    p++;
+                }
+                break;
+            case '\n':
+                s->leng = p - s->text;
+                s->p = p;
+                s->msg = "unterminated string";
+                s->line++;
+                s->bol = p;
+                s->eol++;
+                s->state = S_INITIAL;
+                return EOL;
+        }
+    }
+}
+
+int scan(struct scanner *s)
+{
+    char *p = s->p, *end = s->end, *q;
+    int c, n, k, tok;
+
+    if (s->hex) {
+        s->state = S_HEX;
+        s->hex = 0;
+    }
+    s->eol = 0;
+
+    for (;;) {
+        if (p >= end) {
+            s->p = s->text = p;
+            s->leng = 0;
+            s->tline = s->line;
+            s->tcol = p - s->bol + 1;
+            return EOF;
+        }
+        c = (unsigned char)*p;
+        switch (c) {
+            case ' ':
+            case '\t':
+            case '\r':
+                p++;
+                continue;
+            case '#':
+                q = memchr(p, '\n', end - p);
+                if (q == NULL) {
+                    p = end;
+                    continue;
+                }
+                p = q + 1;
+                s->line++;
+                s->bol = p;
+                continue;
+            case '\\':
+                for (q = p + 1; q < end && (*q == ' ' || *q == '\t' ||
+                        *q == '\r'); q++)
+                    ;
+                if (q < end && *q == '\n') {
+                    p = q + 1;
+                    s->line++;
+                    s->bol = p;
+                    continue;
+                }
+                break;
+            case '\n':
+                s->text = p;
+                s->leng = 1;
+                s->p = p + 1;
+                s->tline = s->line;
+                s->tcol = p - s->bol + 1;
+                s->line++;
+                s->bol = p + 1;
+                s->eol++;
+                s->state = S_INITIAL;
+                return EOL;
+            case '"':
+                return string(s, p + 1);
+        }
+        break;
+    }
+
+    s->text = p;
+    s->tline = s->line;
+    s->tcol = p - s->bol + 1;
+    if (s->state == S_HEX) {
+        if (Class[c] & C_HEX) {
+            s->val = Hexval[c];
+            n = 1;
+            if (p + 1 < end && (Class[(unsigned char)p[1]] & C_HEX)) {
+                s->val = s->val * 16 + Hexval[(unsigned char)p[1]];
+                n = 2;
+            }
+            tok = INT;
+        } else {
+            n = 1;
+            if ((c | 0x20) >= 'g' && (c | 0x20) <= 'z')
+                while (p + n < end && (Class[(unsigned char)p[n]] & C_LETTER))
+                    n++;
+            s->state = S_INITIAL;
+            tok = ERR;
+        }
+        s->leng = n;
+        s->p = p + n;
+        return tok;
+    }
+
+    if (Class[c] & C_LETTER) {
+        for (n = 1; p + n < end && (Class[(unsigned char)p[n]] & C_LETTER); n++)
+            ;
+        if (p + n < end && p[n] == '=' && (tok = lookup(Prefixes, p, n))) {
+            n++;
+        } else if ((c | 0x20) <= 'g' && (c | 0x20) >= 'a' &&
+                (q = p + 1, q < end) &&
+                ((Class[(unsigned char)*q] & C_DIGIT) ||
+                ((*q == '#' || (*q | 0x20) == 'b' || *q == '+' || *q == '-')
+                && q + 1 < end && (Class[(unsigned char)q[1]] & C_DIGIT)))) {
+            /* a note name */
+            if (!(Class[(unsigned char)*q] & C_DIGIT))
+                q++;
+            while (q < end && (Class[(unsigned char)*q] & C_DIGIT))
+                q++;
+            n = q - p;
+            tok = NOTEVAL;
+        } else if ((tok = lookup(Keywords, p, n)) == 0)
+            tok = ERR;
+    } else if (Class[c] & C_DIGIT || ((c == '-' || c == '+') &&
+            p + 1 < end && (Class[(unsigned char)p[1]] & C_DIGIT))) {
+        if (c == '0' && p + 2 < end && (p[1] | 0x20) == 'x' &&
+                (Class[(unsigned char)p[2]] & C_HEX)) {
+            n = hexadecimal(p + 2, end, &s->val);
+            n += (n < 0) ? -2 : 2;
+            tok = INT;
+        } else {
+            n = decimal(p, end, &s->val);
+            tok = INT;
+            if (n > 0 && c != '-' && c != '+' && p + n < end &&
+                    (p[n] == '.' || (p[n] | 0x20) == 's' ||
+                    (p[n] | 0x20) == 'm') &&
+                    (k = seconds(s, p, n, end)) != 0) {
+                n = k;
+                tok = k > 0 ? SECS : ERR;
+            }
+        }
+        if (n < 0) {
+            /* too large or wrong: the parser reports the whole token */
+            n = -n;
+            tok = ERR;
+        }
+    } else if (c == '$' && p + 1 < end && bankchar(p[1])) {
+        for (n = 1; p + n < end && bankchar(p[n]); n++)
+            ;
+        s->val = bankno(p + 1, n - 1);
+        tok = INT;
+    } else if (c == ':' || c == '/') {
+        n = 1;
+        tok = '/';
+    } else {
+        n = 1;
+        tok = ERR;
+    }
+    s->leng = n;
+    s->p = p + n;
+    return tok;
+}
+
+#if defined(USE_SSE2) || defined(USE_SSSE3)
+/*
+ * The values of 16 characters as hex digits, with a mask of the ones that
+ * are hex digits and a mask of the spaces.
+ */
+static __m128i nibbles16(const char *p, int *hexmask, int *spacemask)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i dig = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i let = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+
+    *hexmask = _mm_movemask_epi8(_mm_or_si128(dig, let));
+    *spacemask = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+    return _mm_or_si128(
+            _mm_and_si128(dig, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+            _mm_and_si128(let, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+}
+
+/* 16 nibbles, high and low alternating, as 8 bytes in the low half */
+static __m128i pairs16(__m128i v)
+{
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4);
+
+    return _mm_packus_epi16(_mm_or_si128(hi, _mm_srli_epi16(v, 8)),
+            _mm_setzero_si128());
+}
+#endif
+
+#define PACKED	0xffff	/* 16 hex digits */
+#define SPACED	0x36db	/* "ab ab ab ab ab " */
+#define SPACES	0x4924
+
+/*
+ * In hex mode, decode the hex bytes at s->p into out, at most max of them.
+ * This gives the same bytes as calling scan() for each of them, but it
+ * takes whole runs at once: 16 characters at a time when they are packed
+ * pairs or pairs separated by single spaces, as mf2t writes them.  Stops
+ * at anything but hex digits, spaces and continuation lines (the end of
+ * the line, a comment, an error) and leaves that to scan().  Returns the
+ * number of bytes.
+ */
+long scanhex(struct scanner *s, unsigned char *out, long max)
+{
+    char *p = s->p, *end = s->end, *q;
+    long n = 0;
+    int c;
+#if defined(USE_SSE2) || defined(USE_SSSE3)
+    __m128i v;
+    int hex, sp;
+#ifdef USE_SSSE3
+    __m128i spaced = _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, 12, 13,
+            -1, -1, -1, -1, -1, -1);
+#else
+    unsigned char nib[16];
+    int i;
+#endif
+#endif
+
+    if (s->state != S_HEX)
+        return 0;
+    while (n < max && p < end) {
+#if defined(USE_SSE2) || defined(USE_SSSE3)
+        if (end - p >= 16 && max - n >= 8) {
+            v = nibbles16(p, &hex, &sp);
+            if (hex == PACKED) {
+                _mm_storel_epi64((__m128i *)(out + n), pairs16(v));
+                n += 8;
+                p += 16;
+                continue;
+            }
+            if ((hex & 0x7fff) == SPACED && (sp & 0x7fff) == SPACES) {
+#ifdef USE_SSSE3
+                _mm_storel_epi64((__m128i *)(out + n),
+                        pairs16(_mm_shuffle_epi8(v, spaced)));
+#else
+                _mm_storeu_si128((__m128i *)nib, v);
+                for (i = 0; i < 5; i++)
+                    out[n+i] = nib[3*i] << 4 | nib[3*i+1];
+#endif
+                n += 5;
+                p += 15;
+                continue;
+            }
+        }
+#endif
+        c = (unsigned char)*p;
+        if (Class[c] & C_HEX) {
+            c = Hexval[c];
+            if (p + 1 < end && (Class[(unsigned char)p[1]] & C_HEX)) {
+                c = c * 16 + Hexval[(unsigned char)p[1]];
+                p++;
+            }
+            p++;
+            out[n++] = c;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            p++;
+        } else if (c == '\\') {
+            for (q = p + 1; q < end && (*q == ' ' || *q == '\t' ||
+                    *q == '\r'); q++)
+                ;
+            if (q >= end || *q != '\n')
+                break;
+            p = q + 1;
+            s->line++;
+            s->bol = p;
+        } else
+            break;
+    }
+    s->p = p;
+    return n;
+}
@@ -0,0 +1,162 @@
+/*
+ * t2mftok
+ *
+ * Input of t2mf in the token format that mf2t -T writes (see mf2ttok.c).
+ * Each record becomes the event that its line in the text would give,
+ * so the MIDI file is the same as the one made from the text.  Errors
+ * are reported with the offset of the record in the file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "t2mf.h"
+
+#define TOKMAGIC	"MF2TTOK1"
+#define TOKHDRSIZE	16
+#define TOKRECSIZE	16
+
+static char *Base;	/* the start of the file, for the offsets */
+
+static unsigned long getle(unsigned char *p, int n)
+{
+    unsigned long v = 0;
+
+    while (n-- > 0)
+        v = v << 8 | p[n];
+    return v;
+}
+
+/* Is the file in buf in the token format? */
+int istokens(char *buf, long len)
+{
+    if (len < 8 || memcmp(buf, TOKMAGIC, 8) != 0)
+        return 0;
+    Base = buf;
+    return 1;
+}
+
+/*
+ * Read the header from T->sc.p into *format, *ntrks and *division.
+ * Returns -1 when it is not there.
+ */
+int tokheader(struct track *T, int *format, int *ntrks, int *division)
+{
+    unsigned char *p = (unsigned char *)T->sc.p;
+
+    if (T->sc.end - T->sc.p < TOKHDRSIZE ||
+            memcmp(p, TOKMAGIC, 8) != 0) {
+        tokerror(T, T->sc.p - Base, "Missing MF2TTOK1 header");
+        return -1;
+    }
+    *format = getle(p + 8, 2);
+    *ntrks = getle(p + 10, 2);
+    *division = getle(p + 12, 2);
+    T->sc.p += TOKHDRSIZE;
+    return 0;
+}
+
+/*
+ * Read one track from T->sc.p, from its MTrk record up to its TrkEnd,
+ * into the events of T.  A missing track or a payload that goes past
+ * the end of the file makes T->status T_FATAL.
+ */
+void toktrack(struct track *T)
+{
+    unsigned char *p = (unsigned char *)T->sc.p;
+    unsigned char *end = (unsigned char *)T->sc.end;
+    unsigned char *rec, *q;
+    unsigned long tick, n;
+    int token, d1, d2, pad, first = 1;
+    long off;
+
+    T->start = T->sc.p;
+    T->mt = T->mtin;
+    T->mtused = T->mtset = 0;
+    T->status = T_OK;
+    T->nev = 0;
+    T->poollen = 0;
+    T->msglen = 0;
+    T->nsec = 0;
+    T->chan = 0;
+
+    for (;;) {
+        rec = p;
+        off = (char *)rec - Base;
+        if (end - p < TOKRECSIZE) {
+            /* as in the text, a track that is not there at all is fatal */
+            tokerror(T, off, first ? "Missing MTrk" : "Unexpected EOF");
+            T->status = first ? T_FATAL : T_EOF;
+            p = end;
+            break;
+        }
+        tick = getle(p, 8);
+        token = p[8];
+        d1 = p[9];
+        d2 = p[10];
+        n = getle(p + 12, 4);
+        p += TOKRECSIZE;
+        if (n > (unsigned long)(end - p)) {
+            tokerror(T, off, "Payload past the end of the file");
+            T->status = T_FATAL;
+            p = end;
+            break;
+        }
+        p += n;
+        pad = (8 - n % 8) % 8;
+        p += pad < end - p ? pad : end - p;
+
+        if (first && token != 0x01) {
+            tokerror(T, off, "Missing MTrk");
+            T->status = T_FATAL;
+            break;
+        }
+        if (token == 0x01) {
+            if (!first)
+                tokerror(T, off, "Unexpected MTrk");
+            first = 0;
+            continue;
+        }
+        if (token == 0x02)
+            break;
+        if (token >= 0x80 && token < 0xf0) {
+            if (d1 > 127 || d2 > 127 || n != 0) {
+                tokerror(T, off, "Wrong channel message");
+                continue;
+            }
+            T->chan = token & 0x0f;
+            token &= 0xf0;
+            off = T->poollen;
+            reserve(T, 2);
+            T->pool[T->poollen++] = d1;
+            if (token != program_chng && token != channel_aftertouch)
+                T->pool[T->poollen++] = d2;
+            addevent(T, tick, EV_MIDI, token, off);
+            continue;
+        }
+        if (token != system_exclusive && token != 0xf7 &&
+                token != meta_event) {
+            tokerror(T, off, "Unknown token");
+            continue;
+        }
+        q = rec + TOKRECSIZE;
+        if (token == meta_event && d1 == set_tempo && n == 3) {
+            addevent(T, tick, EV_TEMPO, 0, T->poollen)->off =
+                    (long)q[0] << 16 | q[1] << 8 | q[2];
+            continue;
+        }
+        if (token != meta_event && n == 0) {
+            tokerror(T, off, "String or hex input expected");
+            continue;
+        }
+        off = T->poollen;
+        reserve(T, n);
+        memcpy(T->pool + off, q, n);
+        T->poollen += n;
+        if (token == meta_event)
+            addevent(T, tick, EV_META, d1, off);
+        else
+            addevent(T, tick, EV_SYSEX, 0, off);
+    }
+    T->sc.p = (char *)p;
+    T->end = T->sc.p;
+}